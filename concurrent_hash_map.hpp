@@ -0,0 +1,402 @@
+#ifndef CONCURRENT_HASH_MAP_HPP_
+#define CONCURRENT_HASH_MAP_HPP_
+
+#include <string>
+#include <sstream>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>               //For std::this_thread::yield
+#include <cstdint>
+#include <new>                  //For placement new
+#include "ics_exceptions.hpp"
+#include "hash_map.hpp"
+
+
+namespace ics {
+
+
+//Reader/writer lock (C++11 has no std::shared_mutex). state is the number of readers
+//  holding the lock, or -1 while a writer holds it. Waiting writers keep new readers out,
+//  so a steady stream of readers cannot starve a writer. An uncontended lock is one atomic
+//  compare-exchange; a thread that still cannot get the lock after spins yields sleeps on
+//  wake (so waiting writers and readers do not burn the cores the holders need), and unlock
+//  wakes the sleepers, if any.
+//It is not reentrant, even for readers: a thread that already holds it shared and calls
+//  lock_shared again waits forever once a writer is waiting behind the first hold.
+    class ReadWriteLock {
+    public:
+        void lock_shared   ();
+        void unlock_shared ()   {if (state.fetch_sub(1) == 1) wake_sleepers();}
+        void lock          ();
+        void unlock        ()   {state.store(0); wake_sleepers();}
+
+    private:
+        static const int spins = 128;   //Yields before sleeping
+
+        std::atomic<int> state           {0};
+        std::atomic<int> waiting_writers {0};
+        std::atomic<int> sleepers        {0};   //Threads waiting on wake (seq_cst with state, so none misses an unlock)
+        std::mutex              sleep_lock;
+        std::condition_variable wake;
+
+        bool try_lock_shared ();
+        bool try_lock        ();
+        void wake_sleepers   ();
+        template<class Try>
+        void sleep_until     (Try acquired);    //Sleep on wake until acquired() locks
+    };
+
+
+//std::lock_guard for the shared side of a ReadWriteLock
+    class SharedLockGuard {
+    public:
+        explicit SharedLockGuard (ReadWriteLock& l) : lock(l) {lock.lock_shared();}
+        ~SharedLockGuard ()                                   {lock.unlock_shared();}
+        SharedLockGuard (const SharedLockGuard&)             = delete;
+        SharedLockGuard& operator = (const SharedLockGuard&) = delete;
+
+    private:
+        ReadWriteLock& lock;
+    };
+
+
+//A thread-safe map made of shard_count (a power of 2) independent HashMap shards, each
+//  guarded by its own ReadWriteLock. A key's shard comes from the high bits of its mixed
+//  hash (its bin inside the shard from the low bits), and the key is hashed only once.
+//Lookups on different keys run in parallel; writes only exclude operations on the
+//  same shard. The hashing template/constructor rules are identical to HashMap's.
+//Values are returned by copy: a reference into a shard would outlive the shard's lock.
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a) = undefinedhash<KEY>, template<class> class ALLOC = HeapNodeAllocator,
+             class HASH = FunctionPointerHash<KEY,thash>, class EQUALS = std::equal_to<KEY>> class ConcurrentHashMap {
+    public:
+        typedef HashMap<KEY,T,thash,ALLOC,HASH,EQUALS> Shard;
+        typedef typename Shard::Entry                  Entry;
+
+        //Destructor/Constructors
+        ~ConcurrentHashMap();
+
+        explicit ConcurrentHashMap (int shard_count = 16, double the_load_threshold = 1.0, std::size_t (*chash)(const KEY& a) = undefinedhash<KEY>);
+        ConcurrentHashMap (const ConcurrentHashMap&)             = delete;
+        ConcurrentHashMap& operator = (const ConcurrentHashMap&) = delete;
+
+
+        //Queries (each shard is locked in turn: size/empty are not a snapshot of all shards)
+        bool        empty   () const;
+        std::size_t size    () const;
+        bool        has_key (const KEY& key) const;
+        bool        get     (const KEY& key, T& value) const;   //Copies key's value into value; false if key is absent
+        int         shards  () const;
+
+
+        //Commands (put/erase return and throw as HashMap's do, and erase shrinks a shard as
+        //  HashMap::erase does: see HashMap::set_shrink_threshold, which this sets for every shard)
+        T    put   (const KEY& key, const T& value);
+        T    erase (const KEY& key);
+        void clear ();
+        void set_shrink_threshold (double low_water);
+
+        //Atomically update key's value in place: f(T&) runs while key's shard is write-locked,
+        //  so f must not call back into this map. Both return a copy of the updated value.
+        //  compute            inserts a default-constructed T first if key is absent
+        //  compute_if_present throws KeyError if key is absent
+        template<class F>
+        T    compute            (const KEY& key, F f);
+        template<class F>
+        T    compute_if_present (const KEY& key, F f);
+
+
+        //Iteration: f(const Entry&) is called for every entry, one shard at a time. Each shard
+        //  is read-locked while it is visited, so each shard's entries are a consistent
+        //  snapshot, but different shards may be seen at different times.
+        //  f must not call back into this map, not even to read it: ReadWriteLock is not
+        //  reentrant, so the nested read deadlocks as soon as a writer waits on that shard.
+        template<class F>
+        void for_each (F f) const;
+
+        std::string str () const; //supplies useful debugging information
+
+
+    private:
+        //Padded so that the locks of neighboring shards do not share a cache line
+        struct ShardSlot {
+            ShardSlot (double the_load_threshold, std::size_t (*chash)(const KEY& a)) : map(the_load_threshold, chash) {}
+            mutable ReadWriteLock lock;
+            Shard                 map;
+            char                  padding[64];
+        };
+
+        HASH       hash;            //Hashing policy used (from template or constructor)
+        int        shard_bits;      //shard_count == 2^shard_bits
+        ShardSlot* slots;
+
+        //Helper methods
+        std::size_t shard_of (std::size_t hash_code) const;  //Index of the shard holding hash_code's keys
+    };
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//ReadWriteLock definitions
+
+    inline void ReadWriteLock::lock_shared() {
+        for (int i = 0; i < spins; ++i) {
+            if (try_lock_shared())
+                return;
+            std::this_thread::yield();
+        }
+        sleep_until([this]{return try_lock_shared();});
+    }
+
+
+    inline void ReadWriteLock::lock() {
+        if (try_lock())
+            return;
+        waiting_writers.fetch_add(1, std::memory_order_relaxed);
+        bool locked = false;
+        for (int i = 0; i < spins && !(locked = try_lock()); ++i)
+            std::this_thread::yield();
+        if (!locked)
+            sleep_until([this]{return try_lock();});
+        waiting_writers.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+
+    inline bool ReadWriteLock::try_lock_shared() {
+        int readers = state.load();
+        return readers >= 0 && waiting_writers.load() == 0 && state.compare_exchange_strong(readers, readers + 1);
+    }
+
+
+    inline bool ReadWriteLock::try_lock() {
+        int unlocked = 0;
+        return state.compare_exchange_strong(unlocked, -1);
+    }
+
+
+    inline void ReadWriteLock::wake_sleepers() {
+        if (sleepers.load() != 0) {
+            std::lock_guard<std::mutex> guard(sleep_lock);
+            wake.notify_all();
+        }
+    }
+
+
+    template<class Try>
+    void ReadWriteLock::sleep_until(Try acquired) {
+        std::unique_lock<std::mutex> guard(sleep_lock);
+        sleepers.fetch_add(1);
+        wake.wait(guard, acquired);
+        sleepers.fetch_sub(1);
+    }
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//ConcurrentHashMap class and related definitions
+
+//Destructor/Constructors
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    ConcurrentHashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::~ConcurrentHashMap() {
+        for (int i = 0; i < shards(); ++i)
+            slots[i].~ShardSlot();
+        ::operator delete(slots);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    ConcurrentHashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::ConcurrentHashMap(int shard_count, double the_load_threshold, std::size_t (*chash)(const KEY& k))
+            : hash(hash_policy_traits<HASH>::make(chash)), shard_bits(0) {
+        hash_policy_traits<HASH>::check(hash, chash, "ConcurrentHashMap::constructor");
+        while ((1 << shard_bits) < shard_count)
+            ++shard_bits;
+        slots = static_cast<ShardSlot*>(::operator new(sizeof(ShardSlot) * shards()));
+        for (int i = 0; i < shards(); ++i)
+            new (&slots[i]) ShardSlot(the_load_threshold, chash);
+    }
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//Queries
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    bool ConcurrentHashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::empty() const {
+        return size() == 0;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    std::size_t ConcurrentHashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::size() const {
+        std::size_t answer = 0;
+        for (int i = 0; i < shards(); ++i) {
+            SharedLockGuard guard(slots[i].lock);
+            answer += slots[i].map.size();
+        }
+        return answer;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    bool ConcurrentHashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::has_key (const KEY& key) const {
+        std::size_t hash_code = hash(key);
+        ShardSlot&  s         = slots[shard_of(hash_code)];
+        SharedLockGuard guard(s.lock);
+        return s.map.find_key(key, hash_code, s.map.bin_of(hash_code)) != nullptr;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    bool ConcurrentHashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::get (const KEY& key, T& value) const {
+        std::size_t hash_code = hash(key);
+        ShardSlot&  s         = slots[shard_of(hash_code)];
+        SharedLockGuard guard(s.lock);
+        typename Shard::LN* found = s.map.find_key(key, hash_code, s.map.bin_of(hash_code));
+        if (found == nullptr)
+            return false;
+        value = found->value.second;
+        return true;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    int ConcurrentHashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::shards () const {
+        return 1 << shard_bits;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    std::string ConcurrentHashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::str() const {
+        std::ostringstream answer;
+        answer << "concurrent_hash_map[shards=" << shards() << "]";
+        for (int i = 0; i < shards(); ++i) {
+            SharedLockGuard guard(slots[i].lock);
+            answer << std::endl << "  shard[" << i << "] size=" << slots[i].map.size() << ": " << slots[i].map.str();
+        }
+        return answer.str();
+    }
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//Commands
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    T ConcurrentHashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::put(const KEY& key, const T& value) {
+        std::size_t hash_code = hash(key);
+        ShardSlot&  s         = slots[shard_of(hash_code)];
+        std::lock_guard<ReadWriteLock> guard(s.lock);
+        std::size_t bin       = s.map.bin_of(hash_code);
+        typename Shard::LN* found = s.map.find_key(key, hash_code, bin);
+        if (found != nullptr) {
+            T old_value = std::move(found->value.second);
+            found->value.second = value;
+            return old_value;
+        }
+        return s.map.insert_new(hash_code, bin, key, value)->value.second;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    T ConcurrentHashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::erase(const KEY& key) {
+        std::size_t hash_code = hash(key);
+        ShardSlot&  s         = slots[shard_of(hash_code)];
+        std::lock_guard<ReadWriteLock> guard(s.lock);
+        typename Shard::LN** link = s.map.find_link(key, hash_code, s.map.bin_of(hash_code));
+        if (link != nullptr) {
+            T to_return = (*link)->value.second;
+            s.map.remove_node(*link);
+            if (!s.map.ensure_shrink_threshold())
+                s.map.migrate_bins(s.map.bins_per_operation);
+            return to_return;
+        }
+        std::ostringstream answer;
+        answer << "ConcurrentHashMap::erase: key(" << key << ") not in Hash";
+        throw KeyError(answer.str());
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void ConcurrentHashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::clear() {
+        for (int i = 0; i < shards(); ++i) {
+            std::lock_guard<ReadWriteLock> guard(slots[i].lock);
+            slots[i].map.clear();
+        }
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void ConcurrentHashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::set_shrink_threshold(double low_water) {
+        for (int i = 0; i < shards(); ++i) {
+            std::lock_guard<ReadWriteLock> guard(slots[i].lock);
+            slots[i].map.set_shrink_threshold(low_water);
+        }
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    template<class F>
+    T ConcurrentHashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::compute(const KEY& key, F f) {
+        std::size_t hash_code = hash(key);
+        ShardSlot&  s         = slots[shard_of(hash_code)];
+        std::lock_guard<ReadWriteLock> guard(s.lock);
+        std::size_t bin       = s.map.bin_of(hash_code);
+        typename Shard::LN* found = s.map.find_key(key, hash_code, bin);
+        if (found == nullptr)
+            found = s.map.insert_new(hash_code, bin, key);
+        f(found->value.second);
+        return found->value.second;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    template<class F>
+    T ConcurrentHashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::compute_if_present(const KEY& key, F f) {
+        std::size_t hash_code = hash(key);
+        ShardSlot&  s         = slots[shard_of(hash_code)];
+        std::lock_guard<ReadWriteLock> guard(s.lock);
+        typename Shard::LN* found = s.map.find_key(key, hash_code, s.map.bin_of(hash_code));
+        if (found == nullptr) {
+            std::ostringstream answer;
+            answer << "ConcurrentHashMap::compute_if_present: key(" << key << ") not in Hash";
+            throw KeyError(answer.str());
+        }
+        f(found->value.second);
+        return found->value.second;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    template<class F>
+    void ConcurrentHashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::for_each(F f) const {
+        for (int i = 0; i < shards(); ++i) {
+            SharedLockGuard guard(slots[i].lock);
+            for (const Entry& kv : static_cast<const Shard&>(slots[i].map))    //const begin(): no writes
+                f(kv);
+        }
+    }
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//Private helper methods
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    std::size_t ConcurrentHashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::shard_of (std::size_t hash_code) const {
+        //High bits of a Fibonacci mix: independent of the low bits that pick the bin in a shard
+        if (shard_bits == 0)
+            return 0;
+        return (std::size_t)(((std::uint64_t)hash_code * 0x9E3779B97F4A7C15ULL) >> (64 - shard_bits));
+    }
+
+
+}
+
+#endif /* CONCURRENT_HASH_MAP_HPP_ */
@@ -8,11 +8,12 @@
 #include "ics46goody.hpp"
 #include "ics_exceptions.hpp"
 #include "hash_map.hpp"
+#include "map_loader.hpp"
 
 
 namespace ics {
 
-int hash_string(const std::string& s) {std::hash<std::string> str_hash; return str_hash(s);}
+std::size_t hash_string(const std::string& s) {return ics::string_hash(s);}
 
 typedef ics::pair<std::string,std::string>                MapEntry;
 typedef ics::HashMap<std::string,std::string,hash_string> MapType;
@@ -43,11 +44,11 @@ class DriverMap {
       std::cout << preface+"  p  - put         m  - empty             l{ - load from {}"      << std::endl;
       std::cout << preface+"  P  - put_all     s  - size              it - iterator commands" << std::endl;
       std::cout << preface+"  e  - erase       k  - contains_key      q  - quit"              << std::endl;
-      std::cout << preface+"  x  - clear       v  - contains_value" << std::endl;
+      std::cout << preface+"  x  - clear       v  - contains_value    lp - load from file (parallel)" << std::endl;
       std::cout << preface+"  =  - =           <  - <<"             << std::endl;
       std::cout << preface+"                   r  - relations"      << std::endl;
 
-      std::string allowable[] = {"[","p","P","e","x","=","g","m","s","k","v","<","r","lf","l{","it","q",""};
+      std::string allowable[] = {"[","p","P","e","x","=","g","m","s","k","v","<","r","lf","lp","l{","it","q",""};
       return ics::prompt_string("\n"+preface+"Enter set command","",allowable);
     }
 
@@ -90,7 +91,7 @@ class DriverMap {
           std::cout << preface+"  finally i = " << i << std::endl;
         }
         else if (i_command == "f") {
-          for (auto/*MapEntry*/ me : m)
+          for (auto/*MapEntry*/ me : static_cast<const MapType&>(m))
             std::cout << preface+"  *(all) = " << me.first << "->" << me.second << std::endl;
         }
         else if (i_command == "q")
@@ -139,7 +140,8 @@ class DriverMap {
 
       else if (command == "g") {
         std::string k = ics::prompt_string(preface+"  Enter key to get");
-        std::cout << preface+"  get = " << m[k] << std::endl;
+        const MapType& cm = m;   //Const lookups leave m shareable by later copies (see copy-on-write)
+        std::cout << preface+"  get = " << (cm.has_key(k) ? cm[k] : m[k]) << std::endl;
       }
 
       else if (command == "m")
@@ -184,6 +186,11 @@ class DriverMap {
         in_set.close();
       }
 
+      else if (command == "lp") {
+        std::string file_name = ics::prompt_string(preface+"  Enter file name to read", "loadmap.txt");
+        std::cout << preface+"  keys added = " << ics::load_key_value_file(m, file_name) << std::endl;
+      }
+
       else if (command == "l{") {
         m = MapType({MapEntry("a","1"), MapEntry("b","2"), MapEntry("c","3"), MapEntry("d","4"), MapEntry("e","5")});
       }
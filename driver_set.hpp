@@ -11,7 +11,7 @@
 
 namespace ics {
 
-int hash_string(const std::string& s) {std::hash<std::string> str_hash; return str_hash(s);}
+std::size_t hash_string(const std::string& s) {return ics::string_hash(s);}
 
 typedef ics::HashSet<std::string,hash_string> SetType;
 
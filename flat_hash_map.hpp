@@ -0,0 +1,770 @@
+#ifndef FLAT_HASH_MAP_HPP_
+#define FLAT_HASH_MAP_HPP_
+
+#include <string>
+#include <iostream>
+#include <sstream>
+#include <cstdint>
+#include <new>                  //For placement new
+#include <initializer_list>
+#include "ics_exceptions.hpp"
+#include "pair.hpp"
+#include "hash_functions.hpp"
+#if defined(__SSE2__)
+#include <emmintrin.h>          //SSE2: 16 control bytes probed per instruction
+#endif
+
+//Trailing/leading zero bits of a (non-zero) 32-bit word
+#ifndef ICS_CTZ32
+#if defined(__GNUC__) || defined(__clang__)
+#define ICS_CTZ32(w) __builtin_ctz(w)
+#define ICS_CLZ32(w) __builtin_clz(w)
+#else
+#define ICS_CTZ32(w) ics::ctz_by_loop(w)
+#define ICS_CLZ32(w) ics::clz_by_loop(w)
+#endif
+#endif
+
+
+namespace ics {
+
+
+    inline int ctz_by_loop (std::uint32_t word) {
+        int answer = 0;
+        for (; (word & 1) == 0; word >>= 1)
+            ++answer;
+        return answer;
+    }
+
+    inline int clz_by_loop (std::uint32_t word) {
+        int answer = 0;
+        for (; (word & 0x80000000u) == 0; word <<= 1)
+            ++answer;
+        return answer;
+    }
+
+
+//FlatHashMap is an open-addressing alternative to HashMap with the same interface.
+//Entries live inline in one array of slots; a parallel array of 1-byte control tags
+//  records whether each slot is empty, deleted, or full (and if full, 7 bits of its
+//  hash). Lookups compare 16 tags at a time (SSE2 when available) and only touch the
+//  slots whose tag matches, so a lookup is usually one tag load and one key compare.
+//The hashing template/constructor rules are identical to HashMap's (see hash_map.hpp).
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a) = undefinedhash<KEY>> class FlatHashMap {
+    public:
+        typedef ics::pair<KEY,T>   Entry;
+        typedef std::size_t (*hashfunc) (const KEY& a);
+
+        //Destructor/Constructors
+        ~FlatHashMap ();
+
+        FlatHashMap          (double the_load_threshold = 0.875, std::size_t (*chash)(const KEY& a) = undefinedhash<KEY>);
+        explicit FlatHashMap (std::size_t initial_bins, double the_load_threshold = 0.875, std::size_t (*chash)(const KEY& k) = undefinedhash<KEY>);
+        explicit FlatHashMap (int initial_bins, double the_load_threshold = 0.875, std::size_t (*chash)(const KEY& k) = undefinedhash<KEY>); //So FlatHashMap(64) is not ambiguous
+        FlatHashMap          (const FlatHashMap<KEY,T,thash>& to_copy, double the_load_threshold = 0.875, std::size_t (*chash)(const KEY& a) = undefinedhash<KEY>);
+        explicit FlatHashMap (const std::initializer_list<Entry>& il, double the_load_threshold = 0.875, std::size_t (*chash)(const KEY& a) = undefinedhash<KEY>);
+
+        //Iterable class must support "for-each" loop: .begin()/.end() and prefix ++ on returned result
+        template <class Iterable>
+        explicit FlatHashMap (const Iterable& i, double the_load_threshold = 0.875, std::size_t (*chash)(const KEY& a) = undefinedhash<KEY>);
+
+
+        //Queries
+        bool        empty () const;
+        std::size_t size  () const;
+        bool has_key    (const KEY& key) const;
+        bool has_value  (const T& value) const;
+        std::string str () const; //supplies useful debugging information; contrast to operator <<
+
+
+        //Commands
+        T    put   (const KEY& key, const T& value);
+        T    erase (const KEY& key);
+        void clear ();
+
+        //Iterable class must support "for-each" loop: .begin()/.end() and prefix ++ on returned result
+        template <class Iterable>
+        std::size_t put_all(const Iterable& i);
+
+
+        //Operators
+
+        T&       operator [] (const KEY&);
+        const T& operator [] (const KEY&) const;
+        FlatHashMap<KEY,T,thash>& operator = (const FlatHashMap<KEY,T,thash>& rhs);
+        bool operator == (const FlatHashMap<KEY,T,thash>& rhs) const;
+        bool operator != (const FlatHashMap<KEY,T,thash>& rhs) const;
+
+        template<class KEY2,class T2, std::size_t (*hash2)(const KEY2& a)>
+        friend std::ostream& operator << (std::ostream& outs, const FlatHashMap<KEY2,T2,hash2>& m);
+
+
+
+        class Iterator {
+        public:
+            typedef std::size_t Cursor;
+
+            //Private constructor called in begin/end, which are friends of FlatHashMap<T>
+            ~Iterator();
+            Entry       erase();
+            std::string str  () const;
+            FlatHashMap<KEY,T,thash>::Iterator& operator ++ ();
+            FlatHashMap<KEY,T,thash>::Iterator  operator ++ (int);
+            bool operator == (const FlatHashMap<KEY,T,thash>::Iterator& rhs) const;
+            bool operator != (const FlatHashMap<KEY,T,thash>::Iterator& rhs) const;
+            Entry& operator *  () const;
+            Entry* operator -> () const;
+            friend std::ostream& operator << (std::ostream& outs, const FlatHashMap<KEY,T,thash>::Iterator& i) {
+                outs << i.str(); //Use the same meaning as the debugging .str() method
+                return outs;
+            }
+            friend Iterator FlatHashMap<KEY,T,thash>::begin () const;
+            friend Iterator FlatHashMap<KEY,T,thash>::end   () const;
+
+        private:
+            //If can_erase is false, current indexes the "next" value (must ++ to reach it)
+            Cursor                    current; //Slot index; stops if current == capacity
+            FlatHashMap<KEY,T,thash>* ref_map;
+            std::size_t               expected_mod_count;
+            bool                      can_erase = true;
+
+            //Called in friends begin/end
+            Iterator(FlatHashMap<KEY,T,thash>* iterate_over, bool from_begin);
+        };
+
+
+        Iterator begin () const;
+        Iterator end   () const;
+
+
+    private:
+        //Control tags: full slots store the low 7 bits of the hash (0..127); the others are negative
+        static const signed char ctrl_empty    = -128;
+        static const signed char ctrl_deleted  = -2;
+        static const std::size_t group_width   = 16;  //Tags compared per probe step
+        static const std::size_t min_capacity  = 16;  //Must be >= group_width (see set_ctrl)
+
+        std::size_t (*hash)(const KEY& k);      //Hashing function used (from template or constructor)
+        signed char* ctrl  = nullptr;   //capacity tags, then group_width tags cloning the first ones
+        Entry*       slots = nullptr;   //Raw storage: only slots whose tag is full hold a constructed Entry
+        double load_threshold;          //used+deleted <= capacity*load_threshold
+        std::size_t capacity    = 0;    //# slots (a power of 2 >= min_capacity)
+        std::size_t used        = 0;    //Cache for number of key->value pairs in the table
+        std::size_t growth_left = 0;    //# empty slots that may still be filled before rehashing
+        std::size_t mod_count   = 0;    //For sensing concurrent modification
+
+
+        //Helper methods
+        static int           match_byte   (const signed char* g, signed char b);//Bitmask of the group tags equal to b
+        static std::size_t   round_capacity(std::size_t n);                   //Smallest legal capacity holding n slots; IcsError if none fits
+        static double        checked_load_threshold(double t);                //t; IcsError if open addressing cannot use t
+
+        std::size_t find_slot            (const KEY& key)              const;  //Returns index of key's slot, or capacity if absent
+        std::size_t find_insert_slot     (std::size_t h)               const;  //Returns index of first empty/deleted slot on h's probe sequence
+        std::size_t next_full            (std::size_t i)               const;  //Returns index of first full slot >= i, or capacity
+        void        set_ctrl             (std::size_t i, signed char tag);     //Also writes the cloned tag at the end of ctrl
+        void        erase_slot           (std::size_t i);                      //Destroy the entry in slot i and retag it
+
+        void        allocate_table       (std::size_t new_capacity);           //Empty table with new_capacity slots
+        void        ensure_load_threshold(std::size_t new_used);               //Reallocate (grow or purge deletes) if no growth is left
+        void        rehash               (std::size_t new_capacity);           //Move every entry into a fresh table
+        void        delete_table         ();                                   //Destroy all entries and free ctrl/slots
+    };
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//FlatHashMap class and related definitions
+
+//Destructor/Constructors
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    FlatHashMap<KEY,T,thash>::~FlatHashMap() {
+        delete_table();
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    FlatHashMap<KEY,T,thash>::FlatHashMap(double the_load_threshold, std::size_t (*chash)(const KEY& k))
+            : hash(thash != (hashfunc)undefinedhash<KEY> ? thash : chash), load_threshold(checked_load_threshold(the_load_threshold)) {
+        if (hash == (hashfunc)undefinedhash<KEY>)
+            throw TemplateFunctionError("FlatHashMap::default constructor: neither specified");
+        if (thash != (hashfunc)undefinedhash<KEY> && chash != (hashfunc)undefinedhash<KEY> && thash != chash)
+            throw TemplateFunctionError("FlatHashMap::default constructor: both specified and different");
+        allocate_table(min_capacity);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    FlatHashMap<KEY,T,thash>::FlatHashMap(std::size_t initial_bins, double the_load_threshold, std::size_t (*chash)(const KEY& k))
+            : hash(thash != (hashfunc)undefinedhash<KEY> ? thash : chash), load_threshold(checked_load_threshold(the_load_threshold)) {
+        if (hash == (hashfunc)undefinedhash<KEY>)
+            throw TemplateFunctionError("FlatHashMap::bins constructor: neither specified");
+        if (thash != (hashfunc)undefinedhash<KEY> && chash != (hashfunc)undefinedhash<KEY> && thash != chash)
+            throw TemplateFunctionError("FlatHashMap::bins constructor: both specified and different");
+        allocate_table(round_capacity(initial_bins));
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    FlatHashMap<KEY,T,thash>::FlatHashMap(int initial_bins, double the_load_threshold, std::size_t (*chash)(const KEY& k))
+            : FlatHashMap(std::size_t(initial_bins < 0 ? 0 : initial_bins), the_load_threshold, chash) {
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    FlatHashMap<KEY,T,thash>::FlatHashMap(const FlatHashMap<KEY,T,thash>& to_copy, double the_load_threshold, std::size_t (*chash)(const KEY& a))
+            : hash(thash != (hashfunc)undefinedhash<KEY> ? thash : chash), load_threshold(checked_load_threshold(the_load_threshold)) {
+        if (hash == (hashfunc)undefinedhash<KEY>)
+            hash = to_copy.hash;
+        if (thash != (hashfunc)undefinedhash<KEY> && chash != (hashfunc)undefinedhash<KEY> && thash != chash)
+            throw TemplateFunctionError("FlatHashMap::copy constructor: both specified and different");
+        allocate_table(round_capacity(to_copy.used / load_threshold + 1));
+        put_all(to_copy);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    FlatHashMap<KEY,T,thash>::FlatHashMap(const std::initializer_list<Entry>& il, double the_load_threshold, std::size_t (*chash)(const KEY& k))
+            : hash(thash != (hashfunc)undefinedhash<KEY> ? thash : chash), load_threshold(checked_load_threshold(the_load_threshold)) {
+        if (hash == (hashfunc)undefinedhash<KEY>)
+            throw TemplateFunctionError("FlatHashMap::initializer_list constructor: neither specified");
+        if (thash != (hashfunc)undefinedhash<KEY> && chash != (hashfunc)undefinedhash<KEY> && thash != chash)
+            throw TemplateFunctionError("FlatHashMap::initializer_list constructor: both specified and different");
+        allocate_table(min_capacity);
+        for (const Entry& m_entry : il)
+            put(m_entry.first,m_entry.second);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    template <class Iterable>
+    FlatHashMap<KEY,T,thash>::FlatHashMap(const Iterable& i, double the_load_threshold, std::size_t (*chash)(const KEY& k))
+            : hash(thash != (hashfunc)undefinedhash<KEY> ? thash : chash), load_threshold(checked_load_threshold(the_load_threshold)) {
+        if (hash == (hashfunc)undefinedhash<KEY>)
+            throw TemplateFunctionError("FlatHashMap::Iterable constructor: neither specified");
+        if (thash != (hashfunc)undefinedhash<KEY> && chash != (hashfunc)undefinedhash<KEY> && thash != chash)
+            throw TemplateFunctionError("FlatHashMap::Iterable constructor: both specified and different");
+        allocate_table(min_capacity);
+        for (const Entry& m_entry : i)
+            put(m_entry.first,m_entry.second);
+    }
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//Queries
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    bool FlatHashMap<KEY,T,thash>::empty() const {
+        return used == 0;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    std::size_t FlatHashMap<KEY,T,thash>::size() const {
+        return used;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    bool FlatHashMap<KEY,T,thash>::has_key (const KEY& key) const {
+        return find_slot(key) != capacity;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    bool FlatHashMap<KEY,T,thash>::has_value (const T& value) const {
+        for (std::size_t i = next_full(0); i < capacity; i = next_full(i+1))
+            if (slots[i].second == value)
+                return true;
+        return false;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    std::string FlatHashMap<KEY,T,thash>::str() const {
+        std::ostringstream answer;
+        answer << "flat_hash_map[capacity=" << capacity << ",used=" << used << ",growth_left=" << growth_left << "]";
+        for (std::size_t i = next_full(0); i < capacity; i = next_full(i+1))
+            answer << " slot[" << i << "/" << (int)ctrl[i] << "]:" << slots[i].first << "->" << slots[i].second;
+        answer << "(mod_count=" << mod_count << ")";
+        return answer.str();
+    }
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//Commands
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    T FlatHashMap<KEY,T,thash>::put(const KEY& key, const T& value) {
+        std::size_t i = find_slot(key);
+        if (i != capacity) {
+            T old_value = slots[i].second;
+            slots[i].second = value;
+            return old_value;
+        }
+
+        ensure_load_threshold(used+1);
+        std::size_t h = fibonacci_mix(hash(key));
+        i = find_insert_slot(h);
+        if (ctrl[i] == ctrl_empty)
+            --growth_left;
+        new (&slots[i]) Entry(key,value);
+        set_ctrl(i, (signed char)(h & 0x7F));
+        ++used;
+        ++mod_count;
+        return slots[i].second;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    T FlatHashMap<KEY,T,thash>::erase(const KEY& key) {
+        std::size_t i = find_slot(key);
+        if (i == capacity) {
+            std::ostringstream answer;
+            answer << "FlatHashMap::erase: key(" << key << ") not in Map";
+            throw KeyError(answer.str());
+        }
+        T to_return = slots[i].second;
+        erase_slot(i);
+        ++mod_count;
+        return to_return;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    void FlatHashMap<KEY,T,thash>::clear() {
+        for (std::size_t i = next_full(0); i < capacity; i = next_full(i+1))
+            slots[i].~Entry();
+        for (std::size_t i = 0; i < capacity + group_width; ++i)
+            ctrl[i] = ctrl_empty;
+        growth_left = capacity * load_threshold;
+        used = 0;
+        ++mod_count;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    template<class Iterable>
+    std::size_t FlatHashMap<KEY,T,thash>::put_all(const Iterable& i) {
+        std::size_t count = 0;
+        for (const Entry& m_entry : i) {
+            ++count;
+            put(m_entry.first,m_entry.second);
+        }
+        return count;
+    }
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//Operators
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    T& FlatHashMap<KEY,T,thash>::operator [] (const KEY& key) {
+        std::size_t i = find_slot(key);
+        if (i != capacity)
+            return slots[i].second;
+
+        ensure_load_threshold(used+1);
+        std::size_t h = fibonacci_mix(hash(key));
+        i = find_insert_slot(h);
+        if (ctrl[i] == ctrl_empty)
+            --growth_left;
+        new (&slots[i]) Entry(key,T());
+        set_ctrl(i, (signed char)(h & 0x7F));
+        ++used;
+        ++mod_count;
+        return slots[i].second;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    const T& FlatHashMap<KEY,T,thash>::operator [] (const KEY& key) const {
+        std::size_t i = find_slot(key);
+        if (i != capacity)
+            return slots[i].second;
+
+        std::ostringstream answer;
+        answer << "FlatHashMap::operator []: key(" << key << ") not in Map";
+        throw KeyError(answer.str());
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    FlatHashMap<KEY,T,thash>& FlatHashMap<KEY,T,thash>::operator = (const FlatHashMap<KEY,T,thash>& rhs) {
+        if (this == &rhs)
+            return *this;
+        delete_table();
+        hash           = rhs.hash;
+        load_threshold = rhs.load_threshold;
+        used           = 0;
+        allocate_table(rhs.capacity);
+        put_all(rhs);
+        ++mod_count;
+        return *this;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    bool FlatHashMap<KEY,T,thash>::operator == (const FlatHashMap<KEY,T,thash>& rhs) const {
+        if (this == &rhs)
+            return true;
+        if (used != rhs.used)
+            return false;
+
+        for (std::size_t i = next_full(0); i < capacity; i = next_full(i+1)) {
+            std::size_t j = rhs.find_slot(slots[i].first);
+            if (j == rhs.capacity || slots[i].second != rhs.slots[j].second)
+                return false;
+        }
+        return true;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    bool FlatHashMap<KEY,T,thash>::operator != (const FlatHashMap<KEY,T,thash>& rhs) const {
+        return !(*this == rhs);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    std::ostream& operator << (std::ostream& outs, const FlatHashMap<KEY,T,thash>& m) {
+        outs << "map[";
+        int printed = 0;
+        for (std::size_t i = m.next_full(0); i < m.capacity; i = m.next_full(i+1))
+            outs << (printed++ == 0 ? "" : ",") << m.slots[i].first << "->" << m.slots[i].second;
+        outs << "]";
+        return outs;
+    }
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//Iterator constructors
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    auto FlatHashMap<KEY,T,thash>::begin () const -> FlatHashMap<KEY,T,thash>::Iterator {
+        return Iterator(const_cast<FlatHashMap<KEY,T,thash>*>(this),true);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    auto FlatHashMap<KEY,T,thash>::end () const -> FlatHashMap<KEY,T,thash>::Iterator {
+        return Iterator(const_cast<FlatHashMap<KEY,T,thash>*>(this),false);
+    }
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//Private helper methods
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    int FlatHashMap<KEY,T,thash>::match_byte (const signed char* g, signed char b) {
+#if defined(__SSE2__)
+        __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(b), group));
+#else
+        int mask = 0;
+        for (std::size_t i = 0; i < group_width; ++i)
+            if (g[i] == b)
+                mask |= 1 << i;
+        return mask;
+#endif
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    std::size_t FlatHashMap<KEY,T,thash>::round_capacity (std::size_t n) {
+        const std::size_t max_capacity = ~(~std::size_t(0) >> 1);    //Largest power of 2 in a std::size_t
+        if (n > max_capacity) {
+            std::ostringstream answer;
+            answer << "FlatHashMap::round_capacity: capacity(" << n << ") exceeds " << max_capacity;
+            throw IcsError(answer.str());
+        }
+        std::size_t c = min_capacity;
+        while (c < n)
+            c *= 2;
+        return c;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    double FlatHashMap<KEY,T,thash>::checked_load_threshold (double t) {
+        //Open addressing needs a few empty slots to stop probes (so not even 1.0)
+        if (!(t > 0.0 && t <= 0.9375)) {
+            std::ostringstream answer;
+            answer << "FlatHashMap::checked_load_threshold: load_threshold(" << t << ") not in (0,0.9375]";
+            throw IcsError(answer.str());
+        }
+        return t;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    std::size_t FlatHashMap<KEY,T,thash>::find_slot (const KEY& key) const {
+        std::size_t   h   = fibonacci_mix(hash(key));
+        signed char   h2  = (signed char)(h & 0x7F);
+        std::size_t   pos = (h >> 7) & (capacity-1);
+        //Triangular steps over groups visit every group when capacity is a power of 2
+        for (std::size_t step = group_width; ; pos = (pos + step) & (capacity-1), step += group_width) {
+            const signed char* g = ctrl + pos;
+            for (int m = match_byte(g, h2); m != 0; m &= m-1) {
+                std::size_t i = (pos + ICS_CTZ32(m)) & (capacity-1);
+                if (slots[i].first == key)
+                    return i;
+            }
+            if (match_byte(g, ctrl_empty) != 0)
+                return capacity;
+        }
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    std::size_t FlatHashMap<KEY,T,thash>::find_insert_slot (std::size_t h) const {
+        std::size_t pos = (h >> 7) & (capacity-1);
+        for (std::size_t step = group_width; ; pos = (pos + step) & (capacity-1), step += group_width) {
+            const signed char* g = ctrl + pos;
+            int m = match_byte(g, ctrl_empty) | match_byte(g, ctrl_deleted);
+            if (m != 0)
+                return (pos + ICS_CTZ32(m)) & (capacity-1);
+        }
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    std::size_t FlatHashMap<KEY,T,thash>::next_full (std::size_t i) const {
+        for (; i < capacity; ++i)
+            if (ctrl[i] >= 0)
+                return i;
+        return capacity;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    void FlatHashMap<KEY,T,thash>::set_ctrl (std::size_t i, signed char tag) {
+        ctrl[i] = tag;
+        if (i < group_width)
+            ctrl[capacity + i] = tag;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    void FlatHashMap<KEY,T,thash>::erase_slot (std::size_t i) {
+        slots[i].~Entry();
+        --used;
+        //If every probe window covering i already had an empty tag, no probe ever passed i:
+        //  it can become empty again instead of a tombstone
+        int before = match_byte(ctrl + ((i - group_width) & (capacity-1)), ctrl_empty);
+        int after  = match_byte(ctrl + i, ctrl_empty);
+        int full_before = before == 0 ? 16 : ICS_CLZ32((std::uint32_t)before << 16);
+        int full_after  = after  == 0 ? 16 : ICS_CTZ32(after);
+        if (std::size_t(full_before + full_after) < group_width) {
+            set_ctrl(i, ctrl_empty);
+            ++growth_left;
+        }
+        else
+            set_ctrl(i, ctrl_deleted);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    void FlatHashMap<KEY,T,thash>::allocate_table (std::size_t new_capacity) {
+        capacity    = new_capacity;
+        ctrl        = new signed char[capacity + group_width];
+        slots       = static_cast<Entry*>(::operator new(sizeof(Entry) * capacity));
+        growth_left = capacity * load_threshold;
+        for (std::size_t i = 0; i < capacity + group_width; ++i)
+            ctrl[i] = ctrl_empty;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    void FlatHashMap<KEY,T,thash>::ensure_load_threshold(std::size_t new_used) {
+        if (growth_left > 0)
+            return;
+        //Mostly tombstones: purge them at the same capacity instead of doubling
+        if (new_used <= capacity * load_threshold / 2)
+            rehash(capacity);
+        else
+            rehash(capacity * 2);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    void FlatHashMap<KEY,T,thash>::rehash (std::size_t new_capacity) {
+        signed char* old_ctrl     = ctrl;
+        Entry*       old_slots    = slots;
+        std::size_t  old_capacity = capacity;
+
+        allocate_table(new_capacity);
+        for (std::size_t i = 0; i < old_capacity; ++i)
+            if (old_ctrl[i] >= 0) {
+                std::size_t h = fibonacci_mix(hash(old_slots[i].first));
+                std::size_t j = find_insert_slot(h);
+                new (&slots[j]) Entry(old_slots[i]);
+                set_ctrl(j, (signed char)(h & 0x7F));
+                --growth_left;
+                old_slots[i].~Entry();
+            }
+        delete[] old_ctrl;
+        ::operator delete(old_slots);
+        ++mod_count;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    void FlatHashMap<KEY,T,thash>::delete_table () {
+        if (ctrl == nullptr)
+            return;
+        for (std::size_t i = next_full(0); i < capacity; i = next_full(i+1))
+            slots[i].~Entry();
+        delete[] ctrl;
+        ::operator delete(slots);
+        ctrl     = nullptr;
+        slots    = nullptr;
+        capacity = 0;
+    }
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//Iterator class definitions
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    FlatHashMap<KEY,T,thash>::Iterator::Iterator(FlatHashMap<KEY,T,thash>* iterate_over, bool from_begin)
+            : ref_map(iterate_over), expected_mod_count(ref_map->mod_count) {
+        current = from_begin ? ref_map->next_full(0) : ref_map->capacity;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    FlatHashMap<KEY,T,thash>::Iterator::~Iterator()
+    {}
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    auto FlatHashMap<KEY,T,thash>::Iterator::erase() -> Entry {
+        if (expected_mod_count != ref_map->mod_count)
+            throw ConcurrentModificationError("FlatHashMap::Iterator::erase");
+        if (!can_erase)
+            throw CannotEraseError("FlatHashMap::Iterator::erase Iterator cursor already erased");
+        if (current == ref_map->capacity)
+            throw CannotEraseError("FlatHashMap::Iterator::erase Iterator cursor beyond data structure");
+
+        //Erasing never moves other entries, so the cursor just steps to the next full slot
+        can_erase = false;
+        Entry to_return = ref_map->slots[current];
+        ref_map->erase_slot(current);
+        ++ref_map->mod_count;
+        expected_mod_count = ref_map->mod_count;
+        current = ref_map->next_full(current+1);
+        return to_return;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    std::string FlatHashMap<KEY,T,thash>::Iterator::str() const {
+        std::ostringstream answer;
+        answer << ref_map->str() << "(current=" << current << ",expected_mod_count=" << expected_mod_count << ",can_erase=" << can_erase << ")";
+        return answer.str();
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    auto  FlatHashMap<KEY,T,thash>::Iterator::operator ++ () -> FlatHashMap<KEY,T,thash>::Iterator& {
+        if (expected_mod_count != ref_map->mod_count)
+            throw ConcurrentModificationError("FlatHashMap::Iterator::operator ++");
+
+        if (current == ref_map->capacity)
+            return *this;
+
+        if (can_erase)
+            current = ref_map->next_full(current+1);
+        else
+            can_erase = true;
+
+        return *this;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    auto  FlatHashMap<KEY,T,thash>::Iterator::operator ++ (int) -> FlatHashMap<KEY,T,thash>::Iterator {
+        if (expected_mod_count != ref_map->mod_count)
+            throw ConcurrentModificationError("FlatHashMap::Iterator::operator ++(int)");
+
+        if (current == ref_map->capacity)
+            return *this;
+
+        Iterator to_return(*this);
+        if (can_erase)
+            current = ref_map->next_full(current+1);
+        else
+            can_erase = true;
+
+        return to_return;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    bool FlatHashMap<KEY,T,thash>::Iterator::operator == (const FlatHashMap<KEY,T,thash>::Iterator& rhs) const {
+        const Iterator* rhsASI = dynamic_cast<const Iterator*>(&rhs);
+        if (rhsASI == 0)
+            throw IteratorTypeError("FlatHashMap::Iterator::operator ==");
+        if (expected_mod_count != ref_map->mod_count)
+            throw ConcurrentModificationError("FlatHashMap::Iterator::operator ==");
+        if (ref_map != rhsASI->ref_map)
+            throw ComparingDifferentIteratorsError("FlatHashMap::Iterator::operator ==");
+
+        return current == rhsASI->current;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    bool FlatHashMap<KEY,T,thash>::Iterator::operator != (const FlatHashMap<KEY,T,thash>::Iterator& rhs) const {
+        const Iterator* rhsASI = dynamic_cast<const Iterator*>(&rhs);
+        if (rhsASI == 0)
+            throw IteratorTypeError("FlatHashMap::Iterator::operator !=");
+        if (expected_mod_count != ref_map->mod_count)
+            throw ConcurrentModificationError("FlatHashMap::Iterator::operator !=");
+        if (ref_map != rhsASI->ref_map)
+            throw ComparingDifferentIteratorsError("FlatHashMap::Iterator::operator !=");
+
+        return current != rhsASI->current;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    pair<KEY,T>& FlatHashMap<KEY,T,thash>::Iterator::operator *() const {
+        if (expected_mod_count != ref_map->mod_count)
+            throw ConcurrentModificationError("FlatHashMap::Iterator::operator *");
+        if (!can_erase || current == ref_map->capacity) {
+            std::ostringstream where;
+            where << current << " when size = " << ref_map->size();
+            throw IteratorPositionIllegal("FlatHashMap::Iterator::operator * Iterator illegal: " + where.str());
+        }
+        return ref_map->slots[current];
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a)>
+    pair<KEY,T>* FlatHashMap<KEY,T,thash>::Iterator::operator ->() const {
+        if (expected_mod_count != ref_map->mod_count)
+            throw ConcurrentModificationError("FlatHashMap::Iterator::operator ->");
+        if (!can_erase || current == ref_map->capacity) {
+            std::ostringstream where;
+            where << current << " when size = " << ref_map->size();
+            throw IteratorPositionIllegal("FlatHashMap::Iterator::operator -> Iterator illegal: " + where.str());
+        }
+        return &ref_map->slots[current];
+    }
+
+
+}
+
+#endif /* FLAT_HASH_MAP_HPP_ */
@@ -0,0 +1,277 @@
+#ifndef HASH_FUNCTIONS_HPP_
+#define HASH_FUNCTIONS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>              //For std::memcpy
+#include <string>
+#include <functional>           //For std::hash, std::equal_to
+#include <type_traits>
+#include <atomic>
+#include <chrono>
+#include <random>               //For std::random_device (random_seed)
+#include "ics_exceptions.hpp"
+#include "pair.hpp"
+
+
+namespace ics {
+
+
+#ifndef undefinedhashdefined
+#define undefinedhashdefined
+    template<class T>
+    std::size_t undefinedhash (const T&) {return 0;}
+#endif /* undefinedhashdefined */
+
+
+//Hash policies are the HASH template argument of HashMap/HashSet: a copyable type whose
+//  operator() (const KEY&) const returns the hash of a key. Calls go through the policy
+//  type, so a functor's operator() is inlined into the table code.
+
+
+//Fibonacci (multiply-shift) mix: the multiply pushes every input bit into the high half, which
+//  is folded into the low bits that a power-of-2 mask keeps (HashMap's set_hash_mixing,
+//  and every FlatHashMap probe).
+    inline std::size_t fibonacci_mix (std::size_t hash_code) {
+        std::uint64_t x = (std::uint64_t)hash_code * 0x9E3779B97F4A7C15ULL;
+        return (std::size_t)(x ^ (x >> 32));
+    }
+
+
+//Fast non-cryptographic hash of the length bytes at data, after Wang Yi's (public domain)
+//  wyhash: keys of <= 16 bytes take one 64x64->128 bit multiply; longer keys are consumed
+//  48 bytes per iteration by three independent multiply lanes, then 16 at a time.
+//  Different seeds give unrelated hash functions.
+    inline std::uint64_t hash_bytes (const void* data, std::size_t length, std::uint64_t seed = 0);
+
+//hash_bytes of a string: a thash for string keys, e.g. HashMap<std::string,int,ics::string_hash>
+    inline std::size_t string_hash (const std::string& s) {
+        return (std::size_t)hash_bytes(s.data(), s.size());
+    }
+
+
+//Full-avalanche mixer for 64 bits (the splitmix64 finalizer): every input bit affects
+//  every output bit, so any subset of the result's bits (e.g., a bin mask) is well spread.
+    inline std::uint64_t mix64 (std::uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xBF58476D1CE4E5B9ULL;
+        x ^= x >> 27;
+        x *= 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+
+//mix64 of an integral key: a thash for integer keys, e.g. HashMap<int,int,ics::integer_hash<int>>
+    template<class INT>
+    std::size_t integer_hash (const INT& i) {
+        return (std::size_t)mix64((std::uint64_t)i);
+    }
+
+
+//Fold hash_code into seed, for the hash of a composite key: order matters, so
+//  hash_combine(hash_combine(0,a),b) and hash_combine(hash_combine(0,b),a) differ.
+    inline std::size_t hash_combine (std::size_t seed, std::size_t hash_code) {
+        return (std::size_t)mix64(seed ^ (hash_code + 0x9E3779B97F4A7C15ULL + (seed << 6) + (seed >> 2)));
+    }
+
+
+//Project hash trait: the default HASH of PolicyHashMap (see hash_map.hpp).
+    template<class KEY> struct hash {
+        std::size_t operator () (const KEY& key) const {return std::hash<KEY>()(key);}
+    };
+
+    template<> struct hash<std::string> {
+        std::size_t operator () (const std::string& key) const {return string_hash(key);}
+    };
+
+    template<class T1, class T2> struct hash<pair<T1,T2>> {
+        std::size_t operator () (const pair<T1,T2>& key) const {
+            return hash_combine(hash<T1>()(key.first), hash<T2>()(key.second));
+        }
+    };
+
+
+//A seed that differs between calls and between runs: random_device bits (read once per
+//  process) mixed with a per-call counter
+    inline std::uint64_t random_seed () {
+        static const std::uint64_t process_seed = ((std::uint64_t)std::random_device()() << 32 ^ std::random_device()())
+                                                  ^ (std::uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+        static std::atomic<std::uint64_t> calls(0);
+        return mix64(process_seed + calls.fetch_add(0x9E3779B97F4A7C15ULL, std::memory_order_relaxed));
+    }
+
+//Hash of key under seed: hash_bytes for strings, mix64 for integers (a bijection, so distinct
+//  keys never share a hash), otherwise ics::hash<KEY> combined with the seed
+    inline std::size_t seeded_hash (const std::string& key, std::uint64_t seed) {
+        return (std::size_t)hash_bytes(key.data(), key.size(), seed);
+    }
+
+    template<class KEY>
+    typename std::enable_if<std::is_integral<KEY>::value, std::size_t>::type seeded_hash (const KEY& key, std::uint64_t seed) {
+        return (std::size_t)mix64((std::uint64_t)key ^ seed);
+    }
+
+    template<class KEY>
+    typename std::enable_if<!std::is_integral<KEY>::value, std::size_t>::type seeded_hash (const KEY& key, std::uint64_t seed) {
+        return hash_combine((std::size_t)seed, hash<KEY>()(key));
+    }
+
+
+//A HASH policy seeded randomly by each table that constructs one (a copied table keeps the seed
+//  of the table it copies), so which keys share a bin cannot be predicted from outside the
+//  process: a defense against keys chosen to collide (HashDoS), e.g.
+//  PolicyHashMap<std::string,int,SeededHash<std::string>> m;
+    template<class KEY> class SeededHash {
+    public:
+        SeededHash () : seed(random_seed()) {}
+
+        std::size_t operator () (const KEY& key) const {return seeded_hash(key, seed);}
+
+        std::uint64_t seed;
+    };
+
+
+//Default HASH of HashMap/HashSet: adapts the thash/chash function pointers (see hash_map.hpp).
+//A template-supplied thash is a compile-time constant, so it is called directly (and can be
+//  inlined); only a constructor-supplied chash is called through the stored pointer.
+    template<class KEY, std::size_t (*thash)(const KEY& a)> class FunctionPointerHash {
+    public:
+        typedef std::size_t (*hashfunc) (const KEY& a);
+
+        FunctionPointerHash (hashfunc chash = undefinedhash<KEY>)
+                : hash(thash != (hashfunc)undefinedhash<KEY> ? thash : chash) {}
+
+        std::size_t operator () (const KEY& key) const {
+            return thash != (hashfunc)undefinedhash<KEY> ? thash(key) : hash(key);
+        }
+
+        hashfunc hash;  //The (unique) non-undefinedhash value supplied by thash/chash
+    };
+
+
+//How HashMap/HashSet constructors build, validate and compare HASH policy objects.
+//Any policy type but FunctionPointerHash is default-constructed, takes no chash, and is
+//  assumed stateless (so any two of its objects hash alike).
+    template<class HASH> struct hash_policy_traits {
+        template<class KEY>
+        static HASH make      (std::size_t (*)(const KEY&))           {return HASH();}
+        static bool specified (const HASH&)                    {return true;}
+        static bool same      (const HASH&, const HASH&)       {return true;}
+
+        template<class KEY>
+        static void check     (const HASH&, std::size_t (*chash)(const KEY& a), const std::string& where) {
+            if (chash != undefinedhash<KEY>)
+                throw TemplateFunctionError(where + ": chash requires the function pointer HASH policy");
+        }
+    };
+
+    template<class KEY, std::size_t (*thash)(const KEY& a)> struct hash_policy_traits<FunctionPointerHash<KEY,thash>> {
+        typedef FunctionPointerHash<KEY,thash> HASH;
+        typedef typename HASH::hashfunc        hashfunc;
+
+        static HASH make      (hashfunc chash)                 {return HASH(chash);}
+        static bool specified (const HASH& h)                  {return h.hash != (hashfunc)undefinedhash<KEY>;}
+        static bool same      (const HASH& a, const HASH& b)   {return a.hash == b.hash;}
+
+        static void check     (const HASH& h, hashfunc chash, const std::string& where) {
+            if (!specified(h))
+                throw TemplateFunctionError(where + ": neither specified");
+            if (thash != (hashfunc)undefinedhash<KEY> && chash != (hashfunc)undefinedhash<KEY> && thash != chash)
+                throw TemplateFunctionError(where + ": both specified and different");
+        }
+    };
+
+    template<class KEY> struct hash_policy_traits<SeededHash<KEY>> {
+        typedef SeededHash<KEY> HASH;
+
+        template<class K>
+        static HASH make      (std::size_t (*)(const K&))             {return HASH();}
+        static bool specified (const HASH&)                    {return false;}   //Copies adopt the copied table's seed
+        static bool same      (const HASH& a, const HASH& b)   {return a.seed == b.seed;}
+
+        template<class K>
+        static void check     (const HASH&, std::size_t (*chash)(const K& a), const std::string& where) {
+            if (chash != undefinedhash<K>)
+                throw TemplateFunctionError(where + ": chash requires the function pointer HASH policy");
+        }
+    };
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//hash_bytes and helper definitions
+
+//Multiply a by b (64x64->128 bits): a gets the low half and b the high half
+    inline void multiply_128 (std::uint64_t& a, std::uint64_t& b) {
+#if defined(__SIZEOF_INT128__)
+        __uint128_t product = (__uint128_t)a * b;
+        a = (std::uint64_t)product;
+        b = (std::uint64_t)(product >> 64);
+#else
+        std::uint64_t a_high = a >> 32, a_low = (std::uint32_t)a;
+        std::uint64_t b_high = b >> 32, b_low = (std::uint32_t)b;
+        std::uint64_t high_high = a_high * b_high, high_low = a_high * b_low;
+        std::uint64_t low_high  = a_low  * b_high, low_low  = a_low  * b_low;
+        std::uint64_t middle    = (low_low >> 32) + (std::uint32_t)high_low + low_high;
+        a = (middle << 32) | (std::uint32_t)low_low;
+        b = high_high + (high_low >> 32) + (middle >> 32);
+#endif
+    }
+
+    inline std::uint64_t multiply_fold (std::uint64_t a, std::uint64_t b) {
+        multiply_128(a, b);
+        return a ^ b;
+    }
+
+    inline std::uint64_t read_64 (const unsigned char* p) {std::uint64_t v; std::memcpy(&v, p, 8); return v;}
+    inline std::uint64_t read_32 (const unsigned char* p) {std::uint32_t v; std::memcpy(&v, p, 4); return v;}
+
+
+    inline std::uint64_t hash_bytes (const void* data, std::size_t length, std::uint64_t seed) {
+        static const std::uint64_t secret[4] = {0x2D358DCCAA6C78A5ULL, 0x8BB84B93962EACC9ULL,
+                                                0x4B33A62ED433D4A3ULL, 0x4D5A2DA51DE1AA47ULL};
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        seed ^= multiply_fold(seed ^ secret[0], secret[1]);
+        std::uint64_t a, b;
+        if (length <= 16) {
+            if (length >= 4) {          //Two (perhaps overlapping) 4-byte reads from each end
+                std::size_t middle = (length >> 3) << 2;
+                a = (read_32(p) << 32) | read_32(p + middle);
+                b = (read_32(p + length - 4) << 32) | read_32(p + length - 4 - middle);
+            }
+            else if (length > 0) {
+                a = ((std::uint64_t)p[0] << 16) | ((std::uint64_t)p[length >> 1] << 8) | p[length - 1];
+                b = 0;
+            }
+            else
+                a = b = 0;
+        }
+        else {
+            std::size_t left = length;
+            if (left > 48) {
+                std::uint64_t seed1 = seed, seed2 = seed;
+                do {
+                    seed  = multiply_fold(read_64(p)      ^ secret[1], read_64(p + 8)  ^ seed);
+                    seed1 = multiply_fold(read_64(p + 16) ^ secret[2], read_64(p + 24) ^ seed1);
+                    seed2 = multiply_fold(read_64(p + 32) ^ secret[3], read_64(p + 40) ^ seed2);
+                    p    += 48;
+                    left -= 48;
+                } while (left > 48);
+                seed ^= seed1 ^ seed2;
+            }
+            for (; left > 16; p += 16, left -= 16)
+                seed = multiply_fold(read_64(p) ^ secret[1], read_64(p + 8) ^ seed);
+            a = read_64(p + left - 16);  //The last 16 bytes (perhaps overlapping those hashed above)
+            b = read_64(p + left - 8);
+        }
+        a ^= secret[1];
+        b ^= seed;
+        multiply_128(a, b);
+        return multiply_fold(a ^ secret[0] ^ length, b ^ secret[1]);
+    }
+
+
+}
+
+#endif /* HASH_FUNCTIONS_HPP_ */
@@ -4,71 +4,228 @@
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <cstdint>
+#include <algorithm>            //For std::fill, std::max
+#include <cmath>                //For std::ceil
+#include <limits>
+#include <vector>               //For keys_for_value and the value index
+#include <unordered_map>        //For the value index
+#include <unordered_set>
+#include <set>                  //For std::multiset (tree bins)
+#include <atomic>               //For the sharer counts of copy-on-write tables
 #include <initializer_list>
+#include <type_traits>
+#include <utility>              //For std::move/std::forward
 #include "ics_exceptions.hpp"
 #include "pair.hpp"
+#include "node_allocator.hpp"
+#include "hash_functions.hpp"
+#include "hash_stats.hpp"
+
+
+//Hint that *p will be read soon (a no-op where the compiler has no prefetch builtin)
+#ifndef ICS_PREFETCH
+#if defined(__GNUC__) || defined(__clang__)
+#define ICS_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define ICS_PREFETCH(p) ((void)0)
+#endif
+#endif
+
+//Index of the lowest set bit of a (non-zero) 64-bit word
+#ifndef ICS_LOWEST_BIT
+#if defined(__GNUC__) || defined(__clang__)
+#define ICS_LOWEST_BIT(w) ((std::size_t)__builtin_ctzll(w))
+#else
+#define ICS_LOWEST_BIT(w) ics::lowest_bit_by_loop(w)
+#endif
+#endif
 
 
 namespace ics {
 
 
-#ifndef undefinedhashdefined
-#define undefinedhashdefined
-    template<class T>
-    int undefinedhash (const T& a) {return 0;}
-#endif /* undefinedhashdefined */
+    inline std::size_t lowest_bit_by_loop (std::uint64_t word) {
+        std::size_t answer = 0;
+        for (; (word & 1) == 0; word >>= 1)
+            ++answer;
+        return answer;
+    }
+
+
+//a < b for a KEY with operator <; otherwise false (all keys equivalent)
+    template<class KEY> struct key_order {
+        template<class K>
+        static auto less (const K& a, const K& b, int)  -> decltype(bool(a < b)) {return a < b;}
+        template<class K>
+        static bool less (const K&, const K&, long)     {return false;}
+        static bool less (const KEY& a, const KEY& b)   {return less(a, b, 0);}
+    };
 
-//Instantiate the templated class supplying thash(a): produces a hash value for a.
+
+//Instantiate the templated class supplying thash(a): produces a (std::size_t) hash value for a.
 //If thash is defaulted to undefinedhash in the template, then a constructor must supply chash.
 //If both thash and chash are supplied, then they must be the same (by ==) function.
 //If neither is supplied, or both are supplied but different, TemplateFunctionError is raised.
 //The (unique) non-undefinedhash value supplied by thash/chash is stored in the instance variable hash.
-    template<class KEY,class T, int (*thash)(const KEY& a) = undefinedhash<KEY>> class HashMap {
+//HASH/EQUALS (see hash_functions.hpp) are the hash and key-equality policies: both are called
+//  through their types, so functors are inlined. The default HASH adapts thash/chash as above;
+//  any other HASH is default-constructed, and supplying chash with it raises TemplateFunctionError.
+//The number of bins is always a power of 2 (initial_bins is rounded up): a key's bin is its
+//  hash (or, see set_hash_mixing, its mixed hash) masked, with no division.
+//A bin whose list grows beyond treeify_length nodes (e.g., keys chosen to collide) is also
+//  indexed by a balanced tree ordered by (hash, key) (just hash if KEY has no operator <), so
+//  searching it takes O(log n); the index is dropped when the list shrinks below
+//  untreeify_length. With a seeded HASH (see SeededHash) colliding keys cannot be chosen at all.
+//Small maps: while a map holds at most small_size entries it keeps them in one bin (whatever
+//  load_threshold is), searched linearly by memoized hash; that bin and its occupancy word live
+//  inside the HashMap, so constructing (or emptying to) a small map allocates no bins at all.
+//  The table is hashed, at load_threshold, once it grows beyond small_size entries (or when
+//  constructed with initial_bins > 1). Use InlineNodeAllocator to keep small maps' nodes inline too.
+//An occupancy bitmap (one bit per bin, set iff the bin's list is non-empty) lets iteration and
+//  whole-map scans skip 64 empty bins per word, so they cost O(entries + bins/64), not O(bins).
+//Copies are copy-on-write: copying (constructing from, or assigning) a HashMap shares its bins,
+//  trees, and nodes, in O(1), with every other copy of them (counted by sharers). The first
+//  command on a copy (or a non-const begin(), whose Iterator may change entries) takes a private
+//  copy of the whole table (not just of the bin changed); a clear just lets go of it. A const
+//  HashMap's begin() returns a ConstIterator (const Entries, no erase), so iterating a const
+//  copy leaves the table shared. Only ALLOCs whose nodes any instance may destroy (shareable:
+//  HeapNodeAllocator) share, and small (1 inline bin) maps are just copied.
+//  A T& from the non-const operator [] may be written through at any later time, so a table
+//  that handed one out is leaked: its copies copy it, until it is cleared or assigned. So
+//  copy-on-write does not apply to maps read through the non-const operator [] (read through a
+//  const HashMap's instead). An Iterator from a non-const begin() blocks sharing only until
+//  mod_count changes (the next command invalidates it).
+//An optional value index (see set_value_index) answers has_value/keys_for_value without a scan.
+//ALLOC (see node_allocator.hpp) creates/destroys the list nodes: HeapNodeAllocator (new/delete per
+//  node), SlabNodeAllocator (slabs + free list; clear and the destructor free whole slabs), or
+//  InlineNodeAllocator (the first few nodes in slots inside the map, the rest as HeapNodeAllocator).
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a) = undefinedhash<KEY>, template<class> class ALLOC = HeapNodeAllocator,
+             class HASH = FunctionPointerHash<KEY,thash>, class EQUALS = std::equal_to<KEY>> class HashMap {
     public:
         typedef ics::pair<KEY,T>   Entry;
-        typedef int (*hashfunc) (const KEY& a);
+        typedef std::size_t (*hashfunc) (const KEY& a);
 
         //Destructor/Constructors
         ~HashMap ();
 
-        HashMap          (double the_load_threshold = 1.0, int (*chash)(const KEY& a) = undefinedhash<KEY>);
-        explicit HashMap (int initial_bins, double the_load_threshold = 1.0, int (*chash)(const KEY& k) = undefinedhash<KEY>);
-        HashMap          (const HashMap<KEY,T,thash>& to_copy, double the_load_threshold = 1.0, int (*chash)(const KEY& a) = undefinedhash<KEY>);
-        explicit HashMap (const std::initializer_list<Entry>& il, double the_load_threshold = 1.0, int (*chash)(const KEY& a) = undefinedhash<KEY>);
+        HashMap          (double the_load_threshold = 1.0, std::size_t (*chash)(const KEY& a) = undefinedhash<KEY>);
+        explicit HashMap (std::size_t initial_bins, double the_load_threshold = 1.0, std::size_t (*chash)(const KEY& k) = undefinedhash<KEY>);
+        explicit HashMap (int initial_bins, double the_load_threshold = 1.0, std::size_t (*chash)(const KEY& k) = undefinedhash<KEY>); //So HashMap(64) is not ambiguous
+        HashMap          (const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>& to_copy, double the_load_threshold = 1.0, std::size_t (*chash)(const KEY& a) = undefinedhash<KEY>);
+        explicit HashMap (const std::initializer_list<Entry>& il, double the_load_threshold = 1.0, std::size_t (*chash)(const KEY& a) = undefinedhash<KEY>);
 
         //Iterable class must support "for-each" loop: .begin()/.end() and prefix ++ on returned result
         template <class Iterable>
-        explicit HashMap (const Iterable& i, double the_load_threshold = 1.0, int (*chash)(const KEY& a) = undefinedhash<KEY>);
+        explicit HashMap (const Iterable& i, double the_load_threshold = 1.0, std::size_t (*chash)(const KEY& a) = undefinedhash<KEY>);
 
 
         //Queries
         bool empty      () const;
-        int  size       () const;
+        std::size_t size() const;
         bool has_key    (const KEY& key) const;
         bool has_value  (const T& value) const;
+        std::vector<KEY> keys_for_value (const T& value) const;   //Every key mapped to value (in no particular order)
         std::string str () const; //supplies useful debugging information; contrast to operator <<
 
+        //Batch lookups of keys[0..count): values[i] points to keys[i]'s value (nullptr if absent);
+        //  found[i] is has_key(keys[i]). Keys are hashed and their bin heads and first nodes
+        //  prefetched ahead of resolving them, so the cache misses of different keys overlap.
+        void get_many      (const KEY* keys, std::size_t count, const T** values) const;
+        void contains_many (const KEY* keys, std::size_t count, bool* found)      const;
+
+        //The table's shape (chain-length histogram, load factor, bytes) and, if compiled with
+        //  ICS_HASH_STATS, its lookup/resize counters (see hash_stats.hpp). stats() walks every
+        //  bin; reset_stats() zeroes the counters.
+        HashStats stats       () const;
+        void      reset_stats ();
+
 
         //Commands
         T    put   (const KEY& key, const T& value);
+        T    put   (const KEY& key, T&& value);
+        T    put   (KEY&& key,      const T& value);
+        T    put   (KEY&& key,      T&& value);
         T    erase (const KEY& key);
         void clear ();
 
+        //Construct entries in place: args are forwarded to T's constructor (no args: default T).
+        //Each returns true if key was absent and its entry was inserted.
+        //  emplace          constructs KEY from key first, so key may be anything KEY is constructible from
+        //  try_emplace      leaves an existing entry (and args) untouched
+        //  insert_or_assign assigns value to an existing entry
+        template<class K, class... Args>
+        bool emplace          (K&& key, Args&&... args);
+        template<class... Args>
+        bool try_emplace      (const KEY& key, Args&&... args);
+        template<class... Args>
+        bool try_emplace      (KEY&& key, Args&&... args);
+        template<class V>
+        bool insert_or_assign (const KEY& key, V&& value);
+        template<class V>
+        bool insert_or_assign (KEY&& key, V&& value);
+
+        //When incremental, growing keeps the old bins alongside the new ones and each later
+        //  insert/erase moves at most bins_per_operation old bins, instead of rehashing every
+        //  node at once. Lookups search both arrays but never move nodes, so they (and any
+        //  live Iterators) stay valid.
+        void set_incremental_resize(bool incremental, int bins_per_operation = 4);
+
+        //When mixing, a key's bin comes from a Fibonacci (multiply-shift) mix of its hash rather than
+        //  its low bits, which repairs weak hashes (e.g., identity hashes of ints with a common
+        //  stride). Off by default: the low bits of a good hash are used as is, and dense int keys
+        //  hashed by identity keep their locality. Switching relinks every node into its new bin.
+        void set_hash_mixing(bool mix_hashes);
+
+        //When indexing values, the map also keeps a hash table from each value (hashed by ics::hash<T>,
+        //  so T needs one) to the nodes holding it: has_value and keys_for_value then take O(1) on
+        //  average (plus the keys found) instead of a scan of every entry. A node returned as a T&
+        //  by operator [] is instead compared by every query, until it is erased (or the map is
+        //  cleared or assigned), as is every node if indexing starts after operator [] returned
+        //  a T&; while an Iterator from a non-const begin() is valid, queries scan, and the next
+        //  command rebuilds the index in O(size()).
+        //Off by default; copies (and assignments) of an indexing map index too, built in O(size()).
+        void set_value_index(bool index_values);
+
+        //reserve grows the bins (now) so that n entries fit without exceeding load_threshold;
+        //  shrink_to_fit shrinks them to the fewest that fit size() entries. Both rehash only
+        //  if the number of bins changes (so Iterators stay valid if it does not).
+        void reserve      (std::size_t n);
+        void shrink_to_fit();
+
+        //When erasing drops the load factor (size()/bins) below low_water, the bins shrink to about
+        //  twice size()/load_threshold. 0 (the default) never shrinks, so bins grown by reserve
+        //  stay until shrink_to_fit; load_threshold/8 is a good choice for maps that empty out.
+        //  low_water must be <= load_threshold/4, so a shrunk table must double before it grows
+        //  again and halve before it shrinks again. Iterator::erase shrinks only once its cursor
+        //  is at the end.
+        void set_shrink_threshold(double low_water);
+
         //Iterable class must support "for-each" loop: .begin()/.end() and prefix ++ on returned result
+        //If it also has a .size(), the bins are first grown (by reserve) to fit size() more entries
         template <class Iterable>
-        int put_all(const Iterable& i);
+        std::size_t put_all(const Iterable& i);
 
 
         //Operators
 
         T&       operator [] (const KEY&);
+        T&       operator [] (KEY&&);
         const T& operator [] (const KEY&) const;
-        HashMap<KEY,T,thash>& operator = (const HashMap<KEY,T,thash>& rhs);
-        bool operator == (const HashMap<KEY,T,thash>& rhs) const;
-        bool operator != (const HashMap<KEY,T,thash>& rhs) const;
+        HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>& operator = (const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>& rhs);
+        bool operator == (const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>& rhs) const;
+        bool operator != (const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>& rhs) const;
+
+        template<class KEY2,class T2, std::size_t (*hash2)(const KEY2& a), template<class> class ALLOC2, class HASH2, class EQUALS2>
+        friend std::ostream& operator << (std::ostream& outs, const HashMap<KEY2,T2,hash2,ALLOC2,HASH2,EQUALS2>& m);
 
-        template<class KEY2,class T2, int (*hash2)(const KEY2& a)>
-        friend std::ostream& operator << (std::ostream& outs, const HashMap<KEY2,T2,hash2>& m);
+        //Uses HashMaps as shards, hashing each key once (for both the shard and its bin)
+        template<class KEY2,class T2, std::size_t (*hash2)(const KEY2& a), template<class> class ALLOC2, class HASH2, class EQUALS2>
+        friend class ConcurrentHashMap;
+
+        //Writes the memoized hash codes (and the hash mixing setting) into a snapshot file
+        template<class KEY2,class T2, std::size_t (*hash2)(const KEY2& a), template<class> class ALLOC2, class HASH2, class EQUALS2>
+        friend void write_snapshot (const HashMap<KEY2,T2,hash2,ALLOC2,HASH2,EQUALS2>& m, const std::string& file_name);
 
 
 
@@ -76,76 +233,260 @@ namespace ics {
         class LN;
 
     public:
+        class ConstIterator;
+
         class Iterator {
         public:
-            typedef pair<int,LN*> Cursor;
+            typedef pair<std::size_t,LN*> Cursor;
 
             //Private constructor called in begin/end, which are friends of HashMap<T>
             ~Iterator();
             Entry       erase();
             std::string str  () const;
-            HashMap<KEY,T,thash>::Iterator& operator ++ ();
-            HashMap<KEY,T,thash>::Iterator  operator ++ (int);
-            bool operator == (const HashMap<KEY,T,thash>::Iterator& rhs) const;
-            bool operator != (const HashMap<KEY,T,thash>::Iterator& rhs) const;
+            HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::Iterator& operator ++ ();
+            HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::Iterator  operator ++ (int);
+            bool operator == (const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::Iterator& rhs) const;
+            bool operator != (const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::Iterator& rhs) const;
             Entry& operator *  () const;
             Entry* operator -> () const;
-            friend std::ostream& operator << (std::ostream& outs, const HashMap<KEY,T,thash>::Iterator& i) {
+            friend std::ostream& operator << (std::ostream& outs, const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::Iterator& i) {
                 outs << i.str(); //Use the same meaning as the debugging .str() method
                 return outs;
             }
-            friend Iterator HashMap<KEY,T,thash>::begin () const;
-            friend Iterator HashMap<KEY,T,thash>::end   () const;
+            friend Iterator HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::begin ();
+            friend Iterator HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::end   ();
+            friend class ConstIterator;
 
         private:
             //If can_erase is false, current indexes the "next" value (must ++ to reach it)
             Cursor                current; //Pair:Bin Index/LN*; stops if LN* == nullptr
-            HashMap<KEY,T,thash>* ref_map;
-            int                   expected_mod_count;
+            HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>* ref_map;
+            std::size_t           expected_mod_count;
             bool                  can_erase = true;
+            bool                  shrink_at_end = false; //erase happened mid-table: check the shrink threshold at the end
 
             //Helper methods
-            void advance_cursors();
+            void advance_cursors();                 //(if at the end afterward and shrink_at_end, may shrink ref_map)
+            void seek_from      (std::size_t bin);  //Cursor to the first node in bins >= bin (old bins follow new ones)
+
+            //Called in friends begin/end
+            Iterator(HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>* iterate_over, bool from_begin);
+        };
+
+        //An Iterator over a const HashMap: it yields const Entries and cannot erase, so it never
+        //  changes a table that copies may share
+        class ConstIterator {
+        public:
+            std::string str  () const;
+            HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::ConstIterator& operator ++ ();
+            HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::ConstIterator  operator ++ (int);
+            bool operator == (const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::ConstIterator& rhs) const;
+            bool operator != (const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::ConstIterator& rhs) const;
+            const Entry& operator *  () const;
+            const Entry* operator -> () const;
+            friend std::ostream& operator << (std::ostream& outs, const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::ConstIterator& i) {
+                outs << i.str(); //Use the same meaning as the debugging .str() method
+                return outs;
+            }
+            friend ConstIterator HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::begin () const;
+            friend ConstIterator HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::end   () const;
+
+        private:
+            Iterator i;             //Only ever read through
 
             //Called in friends begin/end
-            Iterator(HashMap<KEY,T,thash>* iterate_over, bool from_begin);
+            ConstIterator(const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>* iterate_over, bool from_begin);
         };
 
 
-        Iterator begin () const;
-        Iterator end   () const;
+        ConstIterator begin () const;
+        ConstIterator end   () const;
+        Iterator      begin ();     //Unshares first: see copy-on-write above
+        Iterator      end   ();
 
 
     private:
         class LN {
         public:
-            LN ()                         : next(nullptr){}
-            LN (const LN& ln)             : value(ln.value), next(ln.next){}
-            LN (Entry v, LN* n = nullptr) : value(v), next(n){}
+            LN ()                                               : hash_code(0), next(nullptr){}
+            LN (const LN& ln)                                   : value(ln.value), hash_code(ln.hash_code), next(ln.next){}
+            LN (const Entry& v, std::size_t h, LN* n = nullptr) : value(v), hash_code(h), next(n){}
+
+            //Entry is default-constructed, then key and a T built from args are moved/forwarded in
+            template<class K, class... Args>
+            LN (std::size_t h, LN* n, K&& key, Args&&... args)  : hash_code(h), next(n){
+                value.first = std::forward<K>(key);
+                set_value(value.second, std::forward<Args>(args)...);
+            }
+            static void set_value (T&) {}
+            template<class A, class... Args>
+            static void set_value (T& to, A&& a, Args&&... args) {to = T(std::forward<A>(a), std::forward<Args>(args)...);}
 
             Entry value;
+            std::size_t hash_code;  //hash(value.first), memoized: compared before keys, reused when resizing
             LN*   next;
         };
 
-        int (*hash)(const KEY& k);  //Hashing function used (from template or constructor)
-        LN** map      = nullptr;    //Pointer to array of pointers: each bin stores a list with a trailer node
+        HASH   hash;                //Hashing policy used (from template or constructor)
+        EQUALS equals;              //Key equality policy used
+        LN** map      = nullptr;    //Pointer to array of pointers: each bin stores a list (nullptr if empty)
         double load_threshold;      //used/bins <= load_threshold
-        int bins      = 1;         //# bins currently in array (start it >= 1 so no divide by 0 in hash_compress)
-        int used      = 0;          //Cache for number of key->value pairs in the hash table
-        int mod_count = 0;          //For sensing concurrent modification
+        double shrink_threshold = 0; //erase shrinks bins if used/bins < shrink_threshold (0 never)
+        std::size_t bins      = 1;  //# bins currently in array: always a power of 2, so hash_compress can mask
+        bool   mix_hashes     = false; //Compress mix(hash) instead of hash (see set_hash_mixing)
+        std::size_t used      = 0;  //Cache for number of key->value pairs in the hash table
+        std::size_t mod_count = 0;  //For sensing concurrent modification
+        ALLOC<LN> node_alloc;       //Creates/destroys every LN of this map
+
+        //Tree bins: trees[bin] (if not nullptr) indexes the links to map[bin]'s nodes; trees
+        //  is nullptr while tree_count is 0 (so other tables pay one test per search)
+        struct TreeEntry {
+            std::size_t   hash_code;
+            const KEY*    key;
+            mutable LN**  link;     //The pointer to this entry's node: map[bin] or a next
+        };
+        struct TreeOrder {
+            bool operator () (const TreeEntry& a, const TreeEntry& b) const {
+                return a.hash_code != b.hash_code ? a.hash_code < b.hash_code : key_order<KEY>::less(*a.key, *b.key);
+            }
+        };
+        typedef std::multiset<TreeEntry,TreeOrder> BinTree;
+        BinTree**   trees      = nullptr;
+        std::size_t tree_count = 0;
+        static const std::size_t treeify_length   = 8;  //Index a bin's list when it grows beyond this
+        static const std::size_t untreeify_length = 6;  //Drop its index when it shrinks below this
+
+        //A 1-bin table uses these (not the heap) as its bins and bitmap: see allocate_bins
+        static const std::size_t small_size = 8;        //Most entries kept in 1 bin (<= treeify_length)
+        LN*           inline_bin      = nullptr;
+        std::uint64_t inline_occupied = 0;
+#ifdef ICS_HASH_STATS
+        mutable HashCounters counters; //Updated by (const) lookups too
+#endif
+
+        static const std::size_t prefetch_distance = 8; //Keys between find_many's pipeline stages (a power of 2)
+
+        //Incremental resizing: old_map's bins [migrated,old_bins) still hold nodes; the rest are nullptr
+        bool incremental        = false;
+        int         bins_per_operation = 4;
+        LN**        old_map            = nullptr;
+        std::size_t old_bins           = 0;
+        std::size_t migrated           = 0;
+
+        //Occupancy bitmaps: bit i of occupied is set iff map[i] != nullptr (likewise for old_map)
+        std::uint64_t* occupied        = nullptr;
+        std::uint64_t* old_occupied    = nullptr;
+
+        //Copy-on-write: while sharers is not nullptr, map, old_map, trees (with their bitmaps and
+        //  nodes) are shared, read-only, by *sharers HashMaps; every command first calls unshare
+        mutable std::atomic<std::atomic<std::size_t>*> sharers{nullptr};
+        bool leaked = false;        //A T& into this table was handed out: never share it (until clear or =)
+        bool        iterating   = false;    //A non-const begin() handed out an Iterator when mod_count was
+        std::size_t iterated_at = 0;        //  iterated_at: it may write entries until mod_count changes
+        struct Table {              //A table's arrays (and through them its nodes)
+            LN**           map;
+            std::uint64_t* occupied;
+            std::size_t    bins;
+            LN**           old_map;
+            std::uint64_t* old_occupied;
+            std::size_t    old_bins;
+            BinTree**      trees;
+        };
 
+        //Value index (see set_value_index), nullptr unless indexing: nodes_of[v] lists the nodes whose
+        //  value is v, but for the pending ones (returned as a T&, so their values may change at any
+        //  time): queries check those one by one. Not kept while iterating: queries scan instead.
+        struct ValueIndex {
+            std::unordered_map<T,std::vector<const LN*>,ics::hash<T>> nodes_of;
+            std::unordered_map<const LN*,std::size_t> position;  //Of each listed node in its nodes_of list
+            std::unordered_set<const LN*>             pending;
+        };
+        ValueIndex* value_index = nullptr;
 
-        //Helper methods
-        int   hash_compress        (const KEY& key)          const;  //hash function ranged to [0,bins-1]
-        LN*   find_key             (const KEY& key) const;           //Returns reference to key's node or nullptr
-        LN*   copy_list            (LN*   l)                 const;  //Copy the keys/values in a bin (order irrelevant)
-        LN**  copy_hash_table      (LN** ht, int bins)       const;  //Copy the bins/keys/values in ht tree (order in bins irrelevant)
 
-        void  ensure_load_threshold(int new_used);                   //Reallocate if load_factor > load_threshold
-        void  delete_hash_table    (LN**& ht, int bins);             //Deallocate all LN in ht (and the ht itself; ht == nullptr)
+        //Helper methods
+        std::size_t hash_compress  (const KEY& key)          const;  //hash function ranged to [0,bins-1]
+        std::size_t bin_of         (std::size_t hash_code)   const;  //hash_compress for an already computed hash
+        std::size_t bin_in         (std::size_t hash_code, std::size_t of_bins) const; //bin_of for a table with of_bins bins
+        static std::size_t mix     (std::size_t hash_code);          //Spread every hash bit into the bits bin_in keeps
+        static std::size_t round_bins(std::size_t n);                //Smallest power of 2 >= n (and >= 1); IcsError if none fits
+        std::size_t bins_for       (std::size_t entries)     const;  //Fewest bins (a power of 2) holding entries within load_threshold
+        template<class Iterable>
+        static auto size_hint      (const Iterable& i, int)  -> decltype(std::size_t(i.size())); //i.size(): call as size_hint(i,0)
+        template<class Iterable>
+        static std::size_t size_hint(const Iterable& i, long);       //0 (unknown) if i has no .size()
+        LN*   find_key             (const KEY& key, std::size_t hash_code, std::size_t bin) const; //Returns reference to key's node in bin or nullptr
+        LN* const* find_link       (const KEY& key, std::size_t hash_code, std::size_t bin) const; //Returns the link to key's node or nullptr
+        LN**  find_link            (const KEY& key, std::size_t hash_code, std::size_t bin);
+        template<class F>
+        void  find_many            (const KEY* keys, std::size_t count, F found) const; //found(i, find_key for keys[i]), prefetching ahead
+        template<class K, class... Args>
+        LN*   insert_new           (std::size_t hash_code, std::size_t bin, K&& key, Args&&... args); //Add key (known absent) at bin's front
+        template<class K, class V>
+        T     put_forward          (K&& key, V&& value);             //put, forwarding key/value into a new node
+        template<class K, class... Args>
+        bool  try_emplace_forward  (K&& key, Args&&... args);        //try_emplace for either kind of KEY reference
+        template<class K, class V>
+        bool  assign_forward       (K&& key, V&& value);             //insert_or_assign for either kind of KEY reference
+        template<class K>
+        T&    index_forward        (K&& key);                        //operator[] for either kind of KEY reference
+        void  remove_node          (LN*& link);                      //Unlink and destroy the node link points to
+        std::size_t all_bins       ()                        const;  //# bins in map plus (while resizing) old_map
+        std::size_t next_occupied  (std::size_t i)           const;  //First i' >= i with bin_at(i') != nullptr, or all_bins()
+        static std::size_t first_set(const std::uint64_t* bitmap, std::size_t from, std::size_t bins); //First set bit >= from, or bins
+        static std::uint64_t* new_bitmap(std::size_t bins);          //All clear, for bins bins
+        LN**  allocate_bins        (std::size_t n, std::uint64_t*& bitmap); //Empty bins and their bitmap: inline if n is 1 and they are free
+        void  delete_bins          (LN** b, std::uint64_t* bitmap);  //Deallocate what allocate_bins returned (nothing if inline)
+        static void mark_bin       (std::uint64_t* bitmap, std::size_t bin, bool is_occupied);
+        void  refresh_occupied     (std::size_t hash_code);          //Recompute the bits of the bins a node with hash_code may be in
+        LN*   bin_at               (std::size_t i)           const;  //List in bin i of map, then of old_map (nullptr if migrated)
+        LN*&  bin_at               (std::size_t i);
+        LN*   copy_list            (LN*   l);                        //Copy the keys/values in a bin (in order)
+        LN**  copy_hash_table      (LN** ht, std::size_t bins);         //Copy the bins/keys/values in ht tree (order in bins irrelevant)
+
+        bool  ensure_load_threshold(std::size_t new_used);           //Reallocate if load_factor > load_threshold; true if it did
+        bool  ensure_shrink_threshold();                             //Reallocate if load_factor < shrink_threshold; true if it did
+        void  rehash               (std::size_t new_bins);           //Start moving every node into new_bins (a power of 2) bins
+        void  migrate_bins         (std::size_t count);              //Move up to count old_map bins into map
+        void  copy_unmigrated      (const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>& from); //Copy from's not yet migrated old bins into map
+        void  delete_hash_table    (LN**& ht, std::uint64_t*& ht_occupied, std::size_t bins); //Deallocate all LN in ht (and ht/ht_occupied; both nullptr)
+                                                                     //  (with a bulk_release ALLOC, only destroys them: call release_all after)
+
+        bool  shareable            ()                        const;  //Copies may share this table (not inline or leaked; shareable ALLOC)
+        bool  iterator_live        ()                        const;  //An Iterator from a non-const begin() may still be used
+        void  share                (const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>& from); //Use from's table (this has none)
+        bool  release_share        ();                               //Stop sharing; true if copies still share the table
+        void  unshare              ();                               //Take a private copy of a shared table (same layout)
+        Table table                ()                        const;
+        void  delete_table         (Table t);                        //Deallocate t's arrays, trees, and nodes
+        void  drop_table           ();                               //Delete (or stop sharing) the table; this has none
+
+        BinTree* tree_at           (std::size_t bin)         const;  //map[bin]'s tree, or nullptr
+        typename BinTree::iterator tree_entry(BinTree* tree, const LN* node, LN* const* link) const; //node's entry if its link is link, else tree->end()
+        void  treeify              (std::size_t bin);                //Index map[bin]'s list by a new tree
+        void  untreeify            (std::size_t bin);
+        void  delete_trees         ();
+        void  copy_trees           (const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>& from); //Treeify the bins that are trees in from
+        void  added_at_front       (std::size_t bin);                //map[bin] was just prepended: update or create its tree
+        void  tree_unlink          (LN*& link);                      //Remove the node link points to from its tree (if any)
+
+        void  index_value          (const LN* node);                 //Add node (inserted, or its value assigned) to value_index
+        void  unindex_value        (const LN* node);                 //Remove node (to be assigned) from value_index
+        void  forget_value         (const LN* node);                 //Remove node (to be destroyed) from value_index, even if pending
+        void  pend_value           (const LN* node);                 //node's value is returned as a T&: queries check it
+        void  build_value_index    ();                               //Index every node (but pending ones) afresh, unless iterating
+        void  clear_value_index    ();                               //value_index (if any) indexes no nodes
+        void  settle_value_index   ();                               //Once no Iterator may write, rebuild value_index
+        bool  pending_value        (const T& value)          const;  //Some pending node's value is value
     };
 
 
+//A HashMap whose hashing is fixed by the HASH type (no thash/chash), e.g.
+//  PolicyHashMap<std::string,int> m;   //hashes with ics::hash<std::string>
+    template<class KEY,class T, class HASH = ics::hash<KEY>, class EQUALS = std::equal_to<KEY>, template<class> class ALLOC = HeapNodeAllocator>
+    using PolicyHashMap = HashMap<KEY,T,undefinedhash<KEY>,ALLOC,HASH,EQUALS>;
+
+
 
 
 
@@ -155,90 +496,85 @@ namespace ics {
 
 //Destructor/Constructors
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    HashMap<KEY,T,thash>::~HashMap() {
-        delete_hash_table(map, bins);
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::~HashMap() {
+        drop_table();
+        delete value_index;
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    HashMap<KEY,T,thash>::HashMap(double the_load_threshold, int (*chash)(const KEY& k))
-            :load_threshold(the_load_threshold){//,hash(thash != (hashfunc)undefinedhash<T> ? thash : chash){
-        if(thash != (hashfunc)undefinedhash<KEY>)
-            hash = thash;
-        else
-            hash = chash;
-        if (hash == (hashfunc)undefinedhash<KEY>)
-            throw TemplateFunctionError("HashMap::default constructor: neither specified");
-        if (thash != (hashfunc)undefinedhash<KEY> && chash != (hashfunc)undefinedhash<KEY> && thash != chash)
-            throw TemplateFunctionError("HashMap::default constructor: both specified and different");
-        map = new LN*[bins];
-        map[0] = new LN();  // Trailer node
-    }
-
-
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    HashMap<KEY,T,thash>::HashMap(int initial_bins, double the_load_threshold, int (*chash)(const KEY& k))
-            : hash(thash != (hashfunc)undefinedhash<KEY> ? thash : chash), bins(initial_bins), load_threshold(the_load_threshold){
-        if (hash == (hashfunc)undefinedhash<KEY>)
-            throw TemplateFunctionError("HashMap::bins constructor: neither specified");
-        if (thash != (hashfunc)undefinedhash<KEY> && chash != (hashfunc)undefinedhash<KEY> && thash != chash)
-            throw TemplateFunctionError("HashMap::bins constructor: both specified and different");
-        map = new LN*[bins];
-        for(int i = 0; i < bins; ++i){
-            map[i] = new LN();
-        }
-    }
-
-
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    HashMap<KEY,T,thash>::HashMap(const HashMap<KEY,T,thash>& to_copy, double the_load_threshold, int (*chash)(const KEY& a))
-            : hash(thash != (hashfunc)undefinedhash<KEY> ? thash : chash), load_threshold(the_load_threshold){
-        if (hash == (hashfunc)undefinedhash<KEY>)
-            hash = chash;//throw TemplateFunctionError("HashMap::copy constructor: neither specified");
-        if (thash != (hashfunc)undefinedhash<KEY> && chash != (hashfunc)undefinedhash<KEY> && thash != chash)
-            throw TemplateFunctionError("HashMap::copy constructor: both specified and different");
-        bins = to_copy.bins;
-        map = new LN*[bins];
-        for(int i = 0; i < bins; ++i){
-            map[i] = new LN();
-        }
-        if(hash != to_copy.hash)
-            used = put_all(to_copy);
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::HashMap(double the_load_threshold, std::size_t (*chash)(const KEY& k))
+            : hash(hash_policy_traits<HASH>::make(chash)), load_threshold(the_load_threshold){
+        hash_policy_traits<HASH>::check(hash, chash, "HashMap::default constructor");
+        map = allocate_bins(bins, occupied);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::HashMap(std::size_t initial_bins, double the_load_threshold, std::size_t (*chash)(const KEY& k))
+            : hash(hash_policy_traits<HASH>::make(chash)), load_threshold(the_load_threshold), bins(round_bins(initial_bins)){
+        hash_policy_traits<HASH>::check(hash, chash, "HashMap::bins constructor");
+        map = allocate_bins(bins, occupied);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::HashMap(int initial_bins, double the_load_threshold, std::size_t (*chash)(const KEY& k))
+            : HashMap(std::size_t(initial_bins < 0 ? 0 : initial_bins), the_load_threshold, chash) {
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::HashMap(const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>& to_copy, double the_load_threshold, std::size_t (*chash)(const KEY& a))
+            : hash(hash_policy_traits<HASH>::make(chash)), load_threshold(the_load_threshold){
+        if (!hash_policy_traits<HASH>::specified(hash))
+            hash = to_copy.hash;    //Neither specified: hash as to_copy does
+        hash_policy_traits<HASH>::check(hash, chash, "HashMap::copy constructor");
+        bins       = to_copy.bins;
+        mix_hashes = to_copy.mix_hashes;
+        bool same_hash = hash_policy_traits<HASH>::same(hash, to_copy.hash);
+        if (same_hash && to_copy.shareable())
+            share(to_copy);
         else{
-            map = copy_hash_table(to_copy.map, to_copy.bins);
-            used = to_copy.used;
+            map = allocate_bins(bins, occupied);
+            if(!same_hash)
+                used = put_all(to_copy);
+            else{
+                map = copy_hash_table(to_copy.map, to_copy.bins);
+                copy_unmigrated(to_copy);
+                copy_trees(to_copy);
+                used = to_copy.used;
+            }
+        }
+        incremental        = to_copy.incremental;
+        bins_per_operation = to_copy.bins_per_operation;
+        shrink_threshold   = to_copy.shrink_threshold;
+        if (to_copy.value_index != nullptr){
+            value_index = new ValueIndex;
+            build_value_index();
         }
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    HashMap<KEY,T,thash>::HashMap(const std::initializer_list<Entry>& il, double the_load_threshold, int (*chash)(const KEY& k))
-            : hash(thash != (hashfunc)undefinedhash<KEY> ? thash : chash), load_threshold(the_load_threshold){
-        if (hash == (hashfunc)undefinedhash<KEY>)
-            throw TemplateFunctionError("HashMap::initializer_list constructor: neither specified");
-        if (thash != (hashfunc)undefinedhash<KEY> && chash != (hashfunc)undefinedhash<KEY> && thash != chash)
-            throw TemplateFunctionError("HashMap::initializer_list constructor: both specified and different");
-        map = new LN*[bins];
-        map[0] = new LN();
-        for (const Entry& m_entry : il)
-            put(m_entry.first,m_entry.second);
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::HashMap(const std::initializer_list<Entry>& il, double the_load_threshold, std::size_t (*chash)(const KEY& k))
+            : hash(hash_policy_traits<HASH>::make(chash)), load_threshold(the_load_threshold){
+        hash_policy_traits<HASH>::check(hash, chash, "HashMap::initializer_list constructor");
+        bins = bins_for(il.size());
+        map = allocate_bins(bins, occupied);
+        put_all(il);
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
     template <class Iterable>
-    HashMap<KEY,T,thash>::HashMap(const Iterable& i, double the_load_threshold, int (*chash)(const KEY& k))
-            : hash(thash != (hashfunc)undefinedhash<T> ? thash : chash), load_threshold(the_load_threshold){
-        if (hash == (hashfunc)undefinedhash<KEY>)
-            throw TemplateFunctionError("BSTMap::Iterable constructor: neither specified");
-        if (thash != (hashfunc)undefinedhash<KEY> && chash != (hashfunc)undefinedhash<KEY> && thash != chash)
-            throw TemplateFunctionError("BSTMap::Iterable constructor: both specified and different");
-        map = new LN*[bins];
-        map[0] = new LN();
-        for (const Entry& m_entry : i){
-            put(m_entry.first,m_entry.second);
-        }
+    HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::HashMap(const Iterable& i, double the_load_threshold, std::size_t (*chash)(const KEY& k))
+            : hash(hash_policy_traits<HASH>::make(chash)), load_threshold(the_load_threshold){
+        hash_policy_traits<HASH>::check(hash, chash, "HashMap::Iterable constructor");
+        bins = bins_for(size_hint(i,0));
+        map = allocate_bins(bins, occupied);
+        put_all(i);
     }
 
 
@@ -246,51 +582,111 @@ namespace ics {
 //
 //Queries
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    bool HashMap<KEY,T,thash>::empty() const {
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    bool HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::empty() const {
         return used == 0;
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    int HashMap<KEY,T,thash>::size() const {
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    std::size_t HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::size() const {
         return used;
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    bool HashMap<KEY,T,thash>::has_key (const KEY& key) const {
-        for(int i = 0; i < bins; ++i){
-            for(LN*j = map[i]; j->next != nullptr; j = j->next){
-//                std::cout << "j->value.first : " << j->value.first << std::endl;
-//                std::cout << "key: " << key << std::endl;
-//                std::cout << j->value << std::endl;
-                if(j->value.first == key)
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    bool HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::has_key (const KEY& key) const {
+        std::size_t hash_code = hash(key);
+        return find_key(key, hash_code, bin_of(hash_code)) != nullptr;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    bool HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::has_value (const T& value) const {
+        if (value_index != nullptr && !iterating)
+            return value_index->nodes_of.count(value) != 0 || pending_value(value);
+        for(std::size_t i = next_occupied(0); i < all_bins(); i = next_occupied(i+1)){
+            for(LN*j = bin_at(i); j != nullptr; j = j->next){
+                if(j->value.second == value)
                     return true;
             }
         }
         return false;
-        //return find_key(key) != nullptr;
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    bool HashMap<KEY,T,thash>::has_value (const T& value) const {
-        for(int i = 0; i < bins; ++i){
-            for(LN*j = map[i]; j->next != nullptr; j = j->next){
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    std::vector<KEY> HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::keys_for_value (const T& value) const {
+        std::vector<KEY> answer;
+        if (value_index != nullptr && !iterating){
+            auto nodes = value_index->nodes_of.find(value);
+            if (nodes != value_index->nodes_of.end())
+                for (const LN* node : nodes->second)
+                    answer.push_back(node->value.first);
+            for (const LN* node : value_index->pending)
+                if (node->value.second == value)
+                    answer.push_back(node->value.first);
+            return answer;
+        }
+        for(std::size_t i = next_occupied(0); i < all_bins(); i = next_occupied(i+1))
+            for(LN* j = bin_at(i); j != nullptr; j = j->next)
                 if(j->value.second == value)
-                    return true;
-            }
+                    answer.push_back(j->value.first);
+        return answer;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::get_many (const KEY* keys, std::size_t count, const T** values) const {
+        find_many(keys, count, [values](std::size_t i, const LN* node) {values[i] = node == nullptr ? nullptr : &node->value.second;});
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::contains_many (const KEY* keys, std::size_t count, bool* found) const {
+        find_many(keys, count, [found](std::size_t i, const LN* node) {found[i] = node != nullptr;});
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    HashStats HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::stats () const {
+        HashStats answer;
+        answer.size        = used;
+        answer.bins        = all_bins();
+        answer.load_factor = (double)used / bins;
+        answer.tree_bins   = tree_count;
+        answer.chain_lengths.push_back(answer.bins);    //Every bin is empty until counted otherwise
+        for (std::size_t i = next_occupied(0); i < all_bins(); i = next_occupied(i+1)) {
+            std::size_t length = 0;
+            for (LN* j = bin_at(i); j != nullptr; j = j->next)
+                ++length;
+            if (length >= answer.chain_lengths.size())
+                answer.chain_lengths.resize(length+1);
+            --answer.chain_lengths[0];
+            ++answer.chain_lengths[length];
+            answer.max_chain = std::max(answer.max_chain, length);
         }
-        return false;
+        answer.bytes_allocated = used * sizeof(LN);
+        if (map != &inline_bin)
+            answer.bytes_allocated += bins * sizeof(LN*) + (bins+63)/64 * sizeof(std::uint64_t);
+        if (old_map != nullptr && old_map != &inline_bin)
+            answer.bytes_allocated += old_bins * sizeof(LN*) + (old_bins+63)/64 * sizeof(std::uint64_t);
+        ICS_HASH_STATS_DO(counters.fill(answer);)
+        return answer;
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    std::string HashMap<KEY,T,thash>::str() const {
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::reset_stats () {
+        ICS_HASH_STATS_DO(counters.reset();)
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    std::string HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::str() const {
         std::ostringstream answer;
-        for(int i = 0; i < bins; ++i){
-            for(LN* j = map[i]; j->next != nullptr; j = j->next){
+        for(std::size_t i = next_occupied(0); i < all_bins(); i = next_occupied(i+1)){
+            for(LN* j = bin_at(i); j != nullptr; j = j->next){
                 answer << j->value.first << "->" << j->value.second;
             }
         }
@@ -302,44 +698,43 @@ namespace ics {
 //
 //Commands
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    T HashMap<KEY,T,thash>::put(const KEY& key, const T& value) {
-        int hash_index = hash_compress(key);
-        if(has_key(key)){
-            LN* found_key = find_key(key);
-//            std::cout << "key is: " << key << std::endl;
-//            for(LN* i = map[hash_index]; i != nullptr; i = i->next){
-//                std::cout << "i->value.first is: " << i->value.first << std::endl;
-//                if(i->value.first == key){
-//                    T old_value = i->value.second;
-//                    i->value.second = value;
-//                    return old_value;
-//                }
-//            }
-            T old_value = found_key->value.second;
-            found_key->value.second = value;
-            return old_value;
-        }
-        else{
-            ensure_load_threshold(++used);
-            std::cout<< "Hash_index: " << hash_index << std::endl;
-            map[hash_index] = new LN(Entry(key,value), map[hash_index]);
-        }
-        ++mod_count;
-        return map[hash_index]->value.second;
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    T HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::put(const KEY& key, const T& value) {
+        return put_forward(key, value);
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    T HashMap<KEY,T,thash>::erase(const KEY& key) {
-        LN* current = find_key(key);
-        if(current != nullptr){
-            T to_return = current->value.second;
-            LN* to_delete = current->next;
-            *current = *current->next;
-            delete to_delete;
-            --used;
-            ++mod_count;
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    T HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::put(const KEY& key, T&& value) {
+        return put_forward(key, std::move(value));
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    T HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::put(KEY&& key, const T& value) {
+        return put_forward(std::move(key), value);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    T HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::put(KEY&& key, T&& value) {
+        return put_forward(std::move(key), std::move(value));
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    T HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::erase(const KEY& key) {
+        unshare();
+        settle_value_index();
+        std::size_t hash_code = hash(key);
+        LN** link     = find_link(key, hash_code, bin_of(hash_code));
+        if(link != nullptr){
+            T to_return = (*link)->value.second;
+            remove_node(*link);
+            if (ensure_shrink_threshold())
+                ++mod_count;
+            else
+                migrate_bins(bins_per_operation);
             return to_return;
         }
         std::ostringstream answer;
@@ -348,29 +743,161 @@ namespace ics {
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    void HashMap<KEY,T,thash>::clear() {
-        for (int i = 0; i < bins; ++i){
-            for (LN* j = map[i]; j != nullptr;){
-                if(j->next == nullptr){
-                    map[i] = j;
-                    j = nullptr;
-                    break;
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::clear() {
+        if (sharers.load(std::memory_order_relaxed) != nullptr){
+            drop_table();           //Copies keep the shared table: no need to copy it first
+            map = allocate_bins(bins, occupied);
+            iterating = false;
+            clear_value_index();
+            ++mod_count;
+            return;
+        }
+        delete_trees();
+        if (old_map != nullptr){
+            delete_hash_table(old_map, old_occupied, old_bins);   //Migrated bins are nullptr: nothing to delete there
+            old_bins = migrated = 0;
+        }
+        if (ALLOC<LN>::bulk_release){
+            //Free every slab at once
+            delete_hash_table(map, occupied, bins);
+            node_alloc.release_all();
+            map = allocate_bins(bins, occupied);
+        }
+        else{
+            for (std::size_t i = first_set(occupied, 0, bins); i < bins; i = first_set(occupied, i+1, bins)){
+                for (LN* j = map[i]; j != nullptr;){
+                    LN* to_delete = j;
+                    j = j->next;
+                    node_alloc.destroy(to_delete);
                 }
-                LN* to_delete = j;
-                j = j->next;
-                delete to_delete;
+                map[i] = nullptr;
             }
+            std::fill(occupied, occupied + (bins+63)/64, 0);
         }
         used = 0;
+        leaked    = false;          //Every T& and Iterator into the table is now invalid
+        iterating = false;
+        clear_value_index();
         ++mod_count;
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    template<class K, class... Args>
+    bool HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::emplace(K&& key, Args&&... args) {
+        KEY k(std::forward<K>(key));
+        return try_emplace_forward(std::move(k), std::forward<Args>(args)...);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    template<class... Args>
+    bool HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::try_emplace(const KEY& key, Args&&... args) {
+        return try_emplace_forward(key, std::forward<Args>(args)...);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    template<class... Args>
+    bool HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::try_emplace(KEY&& key, Args&&... args) {
+        return try_emplace_forward(std::move(key), std::forward<Args>(args)...);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    template<class V>
+    bool HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::insert_or_assign(const KEY& key, V&& value) {
+        return assign_forward(key, std::forward<V>(value));
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    template<class V>
+    bool HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::insert_or_assign(KEY&& key, V&& value) {
+        return assign_forward(std::move(key), std::forward<V>(value));
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::set_incremental_resize(bool incremental, int bins_per_operation) {
+        this->incremental        = incremental;
+        this->bins_per_operation = bins_per_operation < 1 ? 1 : bins_per_operation;
+        if (!incremental && old_map != nullptr){
+            unshare();
+            migrate_bins(old_bins);
+        }
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::set_hash_mixing(bool mix_hashes) {
+        if (this->mix_hashes == mix_hashes)
+            return;
+        unshare();
+        migrate_bins(old_bins);    //Old bins are located with the current setting
+        this->mix_hashes = mix_hashes;
+        bool was_incremental = incremental;
+        incremental = false;
+        rehash(bins);
+        incremental = was_incremental;
+        ++mod_count;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::set_value_index(bool index_values) {
+        if (!index_values){
+            delete value_index;
+            value_index = nullptr;
+        }
+        else if (value_index == nullptr){
+            value_index = new ValueIndex;
+            if (leaked)                 //Which nodes were returned as a T& is unknown: pend them all
+                for (std::size_t i = next_occupied(0); i < all_bins(); i = next_occupied(i+1))
+                    for (const LN* j = bin_at(i); j != nullptr; j = j->next)
+                        value_index->pending.insert(j);
+            build_value_index();
+        }
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::reserve(std::size_t n) {
+        std::size_t needed = bins_for(n);
+        if (needed <= bins)
+            return;
+        rehash(needed);
+        ++mod_count;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::shrink_to_fit() {
+        std::size_t needed = bins_for(used);
+        if (needed >= bins)
+            return;
+        rehash(needed);
+        ++mod_count;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::set_shrink_threshold(double low_water) {
+        if (low_water < 0 || low_water > load_threshold/4) {
+            std::ostringstream answer;
+            answer << "HashMap::set_shrink_threshold: low_water(" << low_water << ") not in [0," << load_threshold/4 << "]";
+            throw IcsError(answer.str());
+        }
+        shrink_threshold = low_water;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
     template<class Iterable>
-    int HashMap<KEY,T,thash>::put_all(const Iterable& i) {
-        int count = 0;
+    std::size_t HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::put_all(const Iterable& i) {
+        reserve(used + size_hint(i,0));   //An upper bound: some keys may already be present
+        std::size_t count = 0;
         for (const Entry& m_entry : i){
             ++count;
             put(m_entry.first,m_entry.second);
@@ -383,20 +910,22 @@ namespace ics {
 //
 //Operators
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    T& HashMap<KEY,T,thash>::operator [] (const KEY& key) {
-        LN* current = find_key(key);
-        if(current != nullptr)
-            return current->value.second;
-        T empty;
-        put(key, empty);
-        return find_key(key)->value.second;
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    T& HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::operator [] (const KEY& key) {
+        return index_forward(key);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    T& HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::operator [] (KEY&& key) {
+        return index_forward(std::move(key));
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    const T& HashMap<KEY,T,thash>::operator [] (const KEY& key) const {
-        LN* current = find_key(key);
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    const T& HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::operator [] (const KEY& key) const {
+        std::size_t hash_code = hash(key);
+        LN* current   = find_key(key, hash_code, bin_of(hash_code));
         if(current != nullptr)
             return current->value.second;
 
@@ -406,37 +935,63 @@ namespace ics {
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    HashMap<KEY,T,thash>& HashMap<KEY,T,thash>::operator = (const HashMap<KEY,T,thash>& rhs) {
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>& HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::operator = (const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>& rhs) {
         if(this == &rhs)
             return *this;
+        bool same_table = map == rhs.map;   //Already sharing rhs's table
+        if (!same_table){
+            drop_table();
+            leaked = false;
+        }
+        iterating = false;          //mod_count changes below
         load_threshold = rhs.load_threshold;
         bins = rhs.bins;
         used = rhs.used;
         hash = rhs.hash;
-        map = new LN*[bins];
-        for(int i = 0; i < bins; ++i){
-            map[i] = new LN();
+        mix_hashes         = rhs.mix_hashes;
+        incremental        = rhs.incremental;
+        bins_per_operation = rhs.bins_per_operation;
+        shrink_threshold   = rhs.shrink_threshold;
+        if (same_table)
+            ;
+        else if (rhs.shareable())
+            share(rhs);
+        else{
+            map = allocate_bins(bins, occupied);
+            map = copy_hash_table(rhs.map, rhs.bins);
+            copy_unmigrated(rhs);
+            copy_trees(rhs);
+        }
+        if (rhs.value_index == nullptr){
+            delete value_index;
+            value_index = nullptr;
+        }
+        else{
+            if (value_index == nullptr)
+                value_index = new ValueIndex;
+            value_index->pending.clear();
+            build_value_index();
         }
-        map = copy_hash_table(rhs.map, rhs.bins);
+        ++mod_count;                //Iterators (and T&s) into the old table are invalid
 
         return *this;
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    bool HashMap<KEY,T,thash>::operator == (const HashMap<KEY,T,thash>& rhs) const {
-        if (this == &rhs)
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    bool HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::operator == (const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>& rhs) const {
+        if (this == &rhs || map == rhs.map)    //Or sharing one table
             return true;
 
         if (used != rhs.used)
             return false;
 
-        for(int i = 0; i < bins; ++i){
-            for(LN* current = map[i]; current->next != nullptr; current = current->next){
-                if(current->value.first == "")
-                    break;
-                if(current->value.second != rhs[current->value.first])
+        for(std::size_t i = next_occupied(0); i < all_bins(); i = next_occupied(i+1)){
+            for(LN* current = bin_at(i); current != nullptr; current = current->next){
+                std::size_t rhs_code = hash_policy_traits<HASH>::same(rhs.hash, hash) ? current->hash_code : rhs.hash(current->value.first);
+                LN* in_rhs   = rhs.find_key(current->value.first, rhs_code, rhs.bin_of(rhs_code));
+                if(in_rhs == nullptr || current->value.second != in_rhs->value.second)
                     return false;
             }
         }
@@ -444,14 +999,14 @@ namespace ics {
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    bool HashMap<KEY,T,thash>::operator != (const HashMap<KEY,T,thash>& rhs) const {
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    bool HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::operator != (const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>& rhs) const {
         return !(*this == rhs);
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    std::ostream& operator << (std::ostream& outs, const HashMap<KEY,T,thash>& m) {
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    std::ostream& operator << (std::ostream& outs, const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>& m) {
         outs << "map[";
         if(!m.empty())
             outs << m.str();
@@ -464,15 +1019,37 @@ namespace ics {
 //
 //Iterator constructors
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    auto HashMap<KEY,T,thash>::begin () const -> HashMap<KEY,T,thash>::Iterator {
-        return Iterator(const_cast<HashMap<KEY,T,thash>*>(this),true);
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    auto HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::begin () const -> HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::ConstIterator {
+        return ConstIterator(this,true);
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    auto HashMap<KEY,T,thash>::end () const -> HashMap<KEY,T,thash>::Iterator {
-        return Iterator(const_cast<HashMap<KEY,T,thash>*>(this),false);
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    auto HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::end () const -> HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::ConstIterator {
+        return ConstIterator(this,false);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    auto HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::begin () -> HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::Iterator {
+        //Writes nothing unless it must (so reading a private table this way is still a read)
+        if (sharers.load(std::memory_order_relaxed) != nullptr){
+            std::size_t was_mod_count = mod_count;
+            unshare();
+            mod_count = was_mod_count;  //So an end() fetched first still compares equal
+        }
+        if (!iterator_live()){
+            iterating   = true;         //The Iterator may change any value: value_index is not kept
+            iterated_at = mod_count;
+        }
+        return Iterator(this,true);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    auto HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::end () -> HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::Iterator {
+        return Iterator(this,false);
     }
 
 
@@ -480,70 +1057,779 @@ namespace ics {
 //
 //Private helper methods
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    int HashMap<KEY,T,thash>::hash_compress (const KEY& key) const {    // Not sure I'm doing this right
-        return abs(hash(key)) % bins;
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    std::size_t HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::hash_compress (const KEY& key) const {
+        return bin_of(hash(key));
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    std::size_t HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::bin_of (std::size_t hash_code) const {
+        return bin_in(hash_code, bins);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    std::size_t HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::bin_in (std::size_t hash_code, std::size_t of_bins) const {
+        return (mix_hashes ? mix(hash_code) : hash_code) & (of_bins - 1);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    std::size_t HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::mix (std::size_t hash_code) {
+        return fibonacci_mix(hash_code);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    std::size_t HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::round_bins (std::size_t n) {
+        const std::size_t max_bins = ~(~std::size_t(0) >> 1);    //Largest power of 2 in a std::size_t
+        if (n > max_bins) {
+            std::ostringstream answer;
+            answer << "HashMap::round_bins: bins(" << n << ") exceeds " << max_bins;
+            throw IcsError(answer.str());
+        }
+        std::size_t answer = 1;
+        while (answer < n)
+            answer *= 2;
+        return answer;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    typename HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::LN* HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::find_key (const KEY& key, std::size_t hash_code, std::size_t bin) const {
+        LN* const* link = find_link(key, hash_code, bin);
+        return link == nullptr ? nullptr : *link;
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    typename HashMap<KEY,T,thash>::LN* HashMap<KEY,T,thash>::find_key (const KEY& key) const {
-        for(int i = 0; i < bins; ++i) {
-            for(LN* j = map[i]; j != nullptr; j = j->next) {
-                if(j->value.first == key)
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    typename HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::LN* const* HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::find_link (const KEY& key, std::size_t hash_code, std::size_t bin) const {
+        ICS_HASH_STATS_DO(std::size_t compared = 0;)
+        if(tree_count != 0 && trees[bin] != nullptr) {
+            //Search just the entries ordered equivalently to key (one, unless KEY has no operator <)
+            TreeEntry probe{hash_code, &key, nullptr};
+            for(auto i = trees[bin]->lower_bound(probe); i != trees[bin]->end() && !TreeOrder()(probe, *i); ++i) {
+                ICS_HASH_STATS_DO(++compared;)
+                if(equals((*i->link)->value.first, key)) {
+                    ICS_HASH_STATS_DO(counters.count_lookup(compared);)
+                    return i->link;
+                }
+            }
+        }
+        else {
+            for(LN* const* j = &map[bin]; *j != nullptr; j = &(*j)->next) {
+                ICS_HASH_STATS_DO(++compared;)
+                if((*j)->hash_code == hash_code && equals((*j)->value.first, key)) {
+                    ICS_HASH_STATS_DO(counters.count_lookup(compared);)
                     return j;
+                }
             }
         }
+        if(old_map != nullptr) {
+            std::size_t old_bin = bin_in(hash_code, old_bins);
+            if(old_bin >= migrated)
+                for(LN* const* j = &old_map[old_bin]; *j != nullptr; j = &(*j)->next) {
+                    ICS_HASH_STATS_DO(++compared;)
+                    if((*j)->hash_code == hash_code && equals((*j)->value.first, key)) {
+                        ICS_HASH_STATS_DO(counters.count_lookup(compared);)
+                        return j;
+                    }
+                }
+        }
+        ICS_HASH_STATS_DO(counters.count_lookup(compared);)
         return nullptr;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    typename HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::LN** HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::find_link (const KEY& key, std::size_t hash_code, std::size_t bin) {
+        return const_cast<LN**>(static_cast<const HashMap*>(this)->find_link(key, hash_code, bin));
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    template<class F>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::find_many (const KEY* keys, std::size_t count, F found) const {
+        //Key i moves through three stages, prefetch_distance keys apart: hash it and prefetch its
+        //  bin head; prefetch the head's first node; resolve it. So each key's misses were issued
+        //  well before it is resolved, while other keys' misses are outstanding.
+        const std::size_t d = prefetch_distance;
+        std::size_t hash_codes[2*prefetch_distance];  //Ring buffers: key i's entries at i % (2*d)
+        std::size_t in_bin    [2*prefetch_distance];
+        for (std::size_t i = 0; i < count + 2*d; ++i) {
+            if (i >= 2*d && i - 2*d < count) {        //Before key i reuses key i-2*d's slot
+                std::size_t k = i - 2*d;   //old_map (while resizing) is searched without prefetching
+                found(k, find_key(keys[k], hash_codes[k % (2*d)], in_bin[k % (2*d)]));
+            }
+            if (i >= d && i - d < count) {
+                LN* head = map[in_bin[(i-d) % (2*d)]];
+                if (head != nullptr)
+                    ICS_PREFETCH(head);
+            }
+            if (i < count) {
+                hash_codes[i % (2*d)] = hash(keys[i]);
+                in_bin    [i % (2*d)] = bin_of(hash_codes[i % (2*d)]);
+                ICS_PREFETCH(&map[in_bin[i % (2*d)]]);
+            }
+        }
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    template<class K, class... Args>
+    typename HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::LN* HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::insert_new (std::size_t hash_code, std::size_t bin, K&& key, Args&&... args) {
+        if(ensure_load_threshold(used+1))
+            bin = bin_of(hash_code);   //bins changed, so key's bin did too
+        LN* added = map[bin] = node_alloc.create(hash_code, map[bin], std::forward<K>(key), std::forward<Args>(args)...);
+        mark_bin(occupied, bin, true);
+        added_at_front(bin);
+        index_value(added);
+        ++used;
+        ++mod_count;
+        migrate_bins(bins_per_operation);
+        return added;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    template<class K, class V>
+    T HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::put_forward (K&& key, V&& value) {
+        unshare();
+        settle_value_index();
+        std::size_t hash_code  = hash(key);
+        std::size_t hash_index = bin_of(hash_code);
+        LN* found_key  = find_key(key, hash_code, hash_index);
+        if(found_key != nullptr){
+            unindex_value(found_key);
+            T old_value = std::move(found_key->value.second);
+            found_key->value.second = std::forward<V>(value);
+            index_value(found_key);
+            return old_value;
+        }
+        return insert_new(hash_code, hash_index, std::forward<K>(key), std::forward<V>(value))->value.second;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    template<class K, class... Args>
+    bool HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::try_emplace_forward (K&& key, Args&&... args) {
+        unshare();
+        settle_value_index();
+        std::size_t hash_code  = hash(key);
+        std::size_t hash_index = bin_of(hash_code);
+        if(find_key(key, hash_code, hash_index) != nullptr)
+            return false;
+        insert_new(hash_code, hash_index, std::forward<K>(key), std::forward<Args>(args)...);
+        return true;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    template<class K, class V>
+    bool HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::assign_forward (K&& key, V&& value) {
+        unshare();
+        settle_value_index();
+        std::size_t hash_code  = hash(key);
+        std::size_t hash_index = bin_of(hash_code);
+        LN* found_key  = find_key(key, hash_code, hash_index);
+        if(found_key != nullptr){
+            unindex_value(found_key);
+            found_key->value.second = std::forward<V>(value);
+            index_value(found_key);
+            return false;
+        }
+        insert_new(hash_code, hash_index, std::forward<K>(key), std::forward<V>(value));
+        return true;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    template<class K>
+    T& HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::index_forward (K&& key) {
+        unshare();
+        settle_value_index();
+        std::size_t hash_code  = hash(key);
+        std::size_t hash_index = bin_of(hash_code);
+        LN* current    = find_key(key, hash_code, hash_index);
+        if(current == nullptr)
+            current = insert_new(hash_code, hash_index, std::forward<K>(key));   //T default-constructed in place
+        pend_value(current);
+        leaked = true;
+        return current->value.second;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::remove_node (LN*& link) {
+        LN* to_delete = link;
+        if (tree_count != 0)
+            tree_unlink(link);
+        link = to_delete->next;
+        refresh_occupied(to_delete->hash_code);
+        forget_value(to_delete);
+        node_alloc.destroy(to_delete);
+        --used;
+        ++mod_count;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    std::size_t HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::all_bins () const {
+        return old_map == nullptr ? bins : bins + old_bins;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    std::size_t HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::next_occupied (std::size_t i) const {
+        if (i < bins){
+            std::size_t in_map = first_set(occupied, i, bins);
+            if (in_map < bins)
+                return in_map;
+            i = bins;
+        }
+        return old_map == nullptr ? bins : bins + first_set(old_occupied, i - bins, old_bins);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    std::size_t HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::first_set (const std::uint64_t* bitmap, std::size_t from, std::size_t bins) {
+        if (from >= bins)
+            return bins;
+        std::size_t   w    = from / 64;
+        std::uint64_t word = bitmap[w] & (~std::uint64_t(0) << (from % 64));
+        while (word == 0){
+            if (++w >= (bins+63)/64)
+                return bins;
+            word = bitmap[w];
+        }
+        return w*64 + ICS_LOWEST_BIT(word);  //Bits at or beyond bins are never set
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    std::uint64_t* HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::new_bitmap (std::size_t bins) {
+        return new std::uint64_t[(bins+63)/64]();
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    auto HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::allocate_bins (std::size_t n, std::uint64_t*& bitmap) -> LN** {
+        //While rehashing from (or reassigning) a 1-bin table, its inline bin is still in use
+        if (n == 1 && map != &inline_bin && old_map != &inline_bin){
+            inline_bin      = nullptr;
+            inline_occupied = 0;
+            bitmap = &inline_occupied;
+            return &inline_bin;
+        }
+        LN** answer = new LN*[n]();
+        bitmap = new_bitmap(n);
+        return answer;
+    }
+
 
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::delete_bins (LN** b, std::uint64_t* bitmap) {
+        if (b == &inline_bin)
+            return;
+        delete [] b;
+        delete [] bitmap;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::mark_bin (std::uint64_t* bitmap, std::size_t bin, bool is_occupied) {
+        if (is_occupied)
+            bitmap[bin/64] |=  (std::uint64_t(1) << (bin % 64));
+        else
+            bitmap[bin/64] &= ~(std::uint64_t(1) << (bin % 64));
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::refresh_occupied (std::size_t hash_code) {
+        std::size_t bin = bin_of(hash_code);
+        mark_bin(occupied, bin, map[bin] != nullptr);
+        if (old_map != nullptr){
+            std::size_t old_bin = bin_in(hash_code, old_bins);
+            mark_bin(old_occupied, old_bin, old_map[old_bin] != nullptr);
+        }
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    typename HashMap<KEY,T,thash>::LN* HashMap<KEY,T,thash>::copy_list (LN* l) const {
-        if(l->next == nullptr)
-            return new LN();
-        return new LN(l->value, copy_list(l->next));
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    typename HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::LN* HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::bin_at (std::size_t i) const {
+        return i < bins ? map[i] : old_map[i - bins];
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    typename HashMap<KEY,T,thash>::LN** HashMap<KEY,T,thash>::copy_hash_table (LN** ht, int bins) const {   // Calls copy_list
-        for(int i = 0; i < bins; ++i){
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    typename HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::LN*& HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::bin_at (std::size_t i) {
+        return i < bins ? map[i] : old_map[i - bins];
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    typename HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::LN* HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::copy_list (LN* l) {
+        //In order (so the copy has the same layout), appending at tail: no recursion on long lists
+        LN*  answer = nullptr;
+        LN** tail   = &answer;
+        for (; l != nullptr; l = l->next){
+            *tail = node_alloc.create(l->value, l->hash_code);
+            tail  = &(*tail)->next;
+        }
+        return answer;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    typename HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::LN** HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::copy_hash_table (LN** ht, std::size_t bins) {   // Calls copy_list
+        for(std::size_t i = 0; i < bins; ++i){
             map[i] = copy_list(ht[i]);
+            mark_bin(occupied, i, map[i] != nullptr);
         }
         return map;
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    void HashMap<KEY,T,thash>::ensure_load_threshold(int new_used) {
-        if (new_used / bins <= load_threshold)
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    std::size_t HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::bins_for (std::size_t entries) const {
+        if (entries <= small_size)
+            return 1;
+        double needed = std::ceil(entries / load_threshold);
+        const std::size_t too_many = std::numeric_limits<std::size_t>::max();   //round_bins rejects it
+        return round_bins(needed < (double)too_many ? std::size_t(needed) : too_many);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    template<class Iterable>
+    auto HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::size_hint (const Iterable& i, int) -> decltype(std::size_t(i.size())) {
+        return i.size();
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    template<class Iterable>
+    std::size_t HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::size_hint (const Iterable& i, long) {
+        return 0;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    bool HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::ensure_load_threshold(std::size_t new_used) {
+        if ((bins == 1 && new_used <= small_size) || (double)new_used / bins <= load_threshold)
+            return false;
+        rehash(std::max(bins * 2, bins_for(new_used)));    //Leaving small mode may need more than double
+        return true;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    bool HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::ensure_shrink_threshold() {
+        if (bins == 1 || (double)used / bins >= shrink_threshold)
+            return false;
+        std::size_t needed = bins_for(2*used);    //Load factor in (load_threshold/4,load_threshold/2]
+        if (needed >= bins)
+            return false;
+        rehash(needed);
+        return true;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::rehash(std::size_t new_bins) {
+        unshare();                 //Callers have already, except shrinking at an Iterator's end
+        migrate_bins(old_bins);    //Finish the last rehash first
+        delete_trees();            //migrate_bins rebuilds those still needed
+        ICS_HASH_STATS_DO(HashCounters::Clock::time_point start = HashCounters::Clock::now();)
+        old_map  = map;
+        old_occupied = occupied;
+        old_bins = bins;
+        migrated = 0;
+        bins = new_bins;
+        map = allocate_bins(bins, occupied);
+        ICS_HASH_STATS_DO(counters.count_resize(); counters.add_resize_time(start);)
+        if (!incremental)
+            migrate_bins(old_bins);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::migrate_bins(std::size_t count) {
+        if (old_map == nullptr)
             return;
-        LN** old_map = map;
-        bins *= 2;
-        map = new LN*[bins];
-        for (int i=0; i<bins; ++i)
-            map[i] = new LN();
-        for (int i = 0; i < bins/2; ++i){
-            for(LN* j = old_map[i]; j != nullptr ; j = j->next){
-                map[hash_compress(j->value.first)] = new LN(Entry(j->value.first,j->value.second), map[hash_compress(j->value.first)]);
+        ICS_HASH_STATS_DO(HashCounters::Clock::time_point start = HashCounters::Clock::now();)
+        //Relink (rather than copy) every node by its memoized hash
+        for (; count > 0 && migrated < old_bins; --count, ++migrated){
+            //Only the nodes of a long list can make a (non-tree) bin long enough to treeify
+            std::size_t length = 0;
+            for (LN* j = old_map[migrated]; j != nullptr && length <= treeify_length; j = j->next)
+                ++length;
+            bool long_list = length > treeify_length;
+            LN* j = old_map[migrated];
+            while (j != nullptr){
+                LN* to_move = j;
+                j = j->next;
+                std::size_t bin = bin_of(to_move->hash_code);
+                to_move->next = map[bin];
+                map[bin] = to_move;
+                mark_bin(occupied, bin, true);
+                if (long_list || tree_count != 0)
+                    added_at_front(bin);
             }
+            old_map[migrated] = nullptr;
+            mark_bin(old_occupied, migrated, false);
+        }
+        if (migrated == old_bins){
+            delete_bins(old_map, old_occupied);
+            old_map  = nullptr;
+            old_occupied = nullptr;
+            old_bins = migrated = 0;
         }
-        delete old_map;
+        ICS_HASH_STATS_DO(counters.add_resize_time(start);)
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    void HashMap<KEY,T,thash>::delete_hash_table (LN**& ht, int bins) {
-        for (int i = 0; i < bins; ++i){
-            for (LN* j = ht[i]; j != nullptr;){
-                LN* to_delete = j;
-                j = j->next;
-                delete to_delete;
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::copy_unmigrated(const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>& from) {
+        if (from.old_map == nullptr)
+            return;
+        for (std::size_t i = from.migrated; i < from.old_bins; ++i)
+            for (LN* j = from.old_map[i]; j != nullptr; j = j->next){
+                std::size_t bin = bin_of(j->hash_code);
+                map[bin] = node_alloc.create(j->value, j->hash_code, map[bin]);
+                mark_bin(occupied, bin, true);
+            }
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::delete_hash_table (LN**& ht, std::uint64_t*& ht_occupied, std::size_t bins) {
+        //Nodes whose storage is released in bulk need no walk at all if they have no destructor to run
+        if (!ALLOC<LN>::bulk_release || !std::is_trivially_destructible<LN>::value)
+            for (std::size_t i = first_set(ht_occupied, 0, bins); i < bins; i = first_set(ht_occupied, i+1, bins)){
+                for (LN* j = ht[i]; j != nullptr;){
+                    LN* to_delete = j;
+                    j = j->next;
+                    if (ALLOC<LN>::bulk_release)
+                        to_delete->~LN();
+                    else
+                        node_alloc.destroy(to_delete);
+                }
+            }
+        delete_bins(ht, ht_occupied);
+        ht = nullptr;
+        ht_occupied = nullptr;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    bool HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::shareable () const {
+        return ALLOC<LN>::shareable && !leaked && !iterator_live() && map != &inline_bin && old_map != &inline_bin;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    bool HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::iterator_live () const {
+        return iterating && iterated_at == mod_count;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::share (const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>& from) {
+        std::atomic<std::size_t>* s = from.sharers.load(std::memory_order_acquire);
+        if (s == nullptr){
+            //from's first copy (other threads may be copying const from too)
+            std::atomic<std::size_t>* first = new std::atomic<std::size_t>(1);
+            if (from.sharers.compare_exchange_strong(s, first, std::memory_order_acq_rel))
+                s = first;
+            else
+                delete first;
+        }
+        s->fetch_add(1, std::memory_order_relaxed);
+        sharers.store(s, std::memory_order_relaxed);
+        map          = from.map;
+        occupied     = from.occupied;
+        bins         = from.bins;
+        old_map      = from.old_map;
+        old_occupied = from.old_occupied;
+        old_bins     = from.old_bins;
+        migrated     = from.migrated;
+        trees        = from.trees;
+        tree_count   = from.tree_count;
+        used         = from.used;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    bool HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::release_share () {
+        std::atomic<std::size_t>* s = sharers.load(std::memory_order_relaxed);
+        if (s == nullptr)
+            return false;
+        sharers.store(nullptr, std::memory_order_relaxed);
+        if (s->fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return true;
+        delete s;
+        return false;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::unshare () {
+        std::atomic<std::size_t>* s = sharers.load(std::memory_order_relaxed);
+        if (s == nullptr)
+            return;
+        if (s->load(std::memory_order_acquire) == 1){
+            release_share();        //Every copy has let go: the table is this map's alone
+            return;
+        }
+
+        //Copy every bin to the same index (so an Iterator's cursor can follow), then let go
+        Table from = table();
+        map     = nullptr;
+        old_map = nullptr;
+        trees   = nullptr;
+        tree_count = 0;
+        map = allocate_bins(bins, occupied);
+        copy_hash_table(from.map, bins);
+        if (from.old_map != nullptr){
+            old_map = allocate_bins(old_bins, old_occupied);
+            for (std::size_t i = migrated; i < old_bins; ++i){
+                old_map[i] = copy_list(from.old_map[i]);
+                mark_bin(old_occupied, i, old_map[i] != nullptr);
             }
         }
-        delete [] map;
+        if (from.trees != nullptr)
+            for (std::size_t i = 0; i < bins; ++i)
+                if (from.trees[i] != nullptr)
+                    treeify(i);
+        if (!release_share())
+            delete_table(from);     //The copies let go meanwhile
+        build_value_index();        //It indexed from's nodes
+        ++mod_count;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    auto HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::table () const -> Table {
+        return Table{map, occupied, bins, old_map, old_occupied, old_bins, trees};
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::delete_table (Table t) {
+        if (t.trees != nullptr){
+            for (std::size_t i = 0; i < t.bins; ++i)
+                delete t.trees[i];
+            delete [] t.trees;
+        }
+        if (t.old_map != nullptr)
+            delete_hash_table(t.old_map, t.old_occupied, t.old_bins);   //Migrated bins are nullptr: nothing to delete there
+        delete_hash_table(t.map, t.occupied, t.bins);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::drop_table () {
+        Table t = table();
+        if (!release_share()){
+            delete_table(t);
+            node_alloc.release_all();
+        }
+        map          = nullptr;
+        occupied     = nullptr;
+        old_map      = nullptr;
+        old_occupied = nullptr;
+        old_bins     = migrated = 0;
+        trees        = nullptr;
+        tree_count   = 0;
+        used         = 0;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    auto HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::tree_at (std::size_t bin) const -> BinTree* {
+        return trees == nullptr ? nullptr : trees[bin];
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    auto HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::tree_entry (BinTree* tree, const LN* node, LN* const* link) const -> typename BinTree::iterator {
+        TreeEntry probe{node->hash_code, &node->value.first, nullptr};
+        for (auto i = tree->lower_bound(probe); i != tree->end() && !TreeOrder()(probe, *i); ++i)
+            if (i->link == link)
+                return i;
+        return tree->end();
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::treeify (std::size_t bin) {
+        if (trees == nullptr)
+            trees = new BinTree*[bins]();
+        BinTree* tree = trees[bin] = new BinTree();
+        for (LN** link = &map[bin]; *link != nullptr; link = &(*link)->next)
+            tree->insert(TreeEntry{(*link)->hash_code, &(*link)->value.first, link});
+        ++tree_count;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::untreeify (std::size_t bin) {
+        delete trees[bin];
+        trees[bin] = nullptr;
+        if (--tree_count == 0){
+            delete [] trees;
+            trees = nullptr;
+        }
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::delete_trees () {
+        if (trees == nullptr)
+            return;
+        for (std::size_t i = 0; i < bins; ++i)
+            delete trees[i];
+        delete [] trees;
+        trees = nullptr;
+        tree_count = 0;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::copy_trees (const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>& from) {
+        if (from.trees == nullptr)
+            return;
+        for (std::size_t i = 0; i < from.bins; ++i)
+            if (from.trees[i] != nullptr)
+                treeify(i);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::added_at_front (std::size_t bin) {
+        BinTree* tree = tree_at(bin);
+        if (tree == nullptr){
+            std::size_t length = 0;
+            for (LN* j = map[bin]; j != nullptr && length <= treeify_length; j = j->next)
+                ++length;
+            if (length > treeify_length)
+                treeify(bin);
+            return;
+        }
+        LN* added = map[bin];
+        if (added->next != nullptr)    //The old front's link is now added's next
+            tree_entry(tree, added->next, &map[bin])->link = &added->next;
+        tree->insert(TreeEntry{added->hash_code, &added->value.first, &map[bin]});
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::tree_unlink (LN*& link) {
+        LN* node = link;
+        std::size_t bin = bin_of(node->hash_code);
+        BinTree* tree = tree_at(bin);
+        if (tree == nullptr)
+            return;
+        auto entry = tree_entry(tree, node, &link);
+        if (entry == tree->end())
+            return;                    //node is in an old (not yet migrated) bin
+        tree->erase(entry);
+        if (node->next != nullptr)     //The next node's link will be node's
+            tree_entry(tree, node->next, &node->next)->link = &link;
+        if (tree->size() < untreeify_length)
+            untreeify(bin);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::index_value (const LN* node) {
+        if (value_index == nullptr || iterating)
+            return;
+        if (!value_index->pending.empty() && value_index->pending.count(node) != 0)
+            return;                             //Pending: checked by queries instead
+        std::vector<const LN*>& nodes = value_index->nodes_of[node->value.second];
+        value_index->position[node] = nodes.size();
+        nodes.push_back(node);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::unindex_value (const LN* node) {
+        if (value_index == nullptr || iterating)
+            return;
+        auto at = value_index->position.find(node);
+        if (at == value_index->position.end())
+            return;                             //Pending: in no nodes_of list
+        auto with_value = value_index->nodes_of.find(node->value.second);
+        std::vector<const LN*>& nodes = with_value->second;
+        nodes[at->second] = nodes.back();       //Fill node's place with the last node
+        value_index->position[nodes.back()] = at->second;
+        nodes.pop_back();
+        value_index->position.erase(at);
+        if (nodes.empty())
+            value_index->nodes_of.erase(with_value);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::forget_value (const LN* node) {
+        if (value_index == nullptr)
+            return;
+        unindex_value(node);
+        value_index->pending.erase(node);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::pend_value (const LN* node) {
+        if (value_index == nullptr || value_index->pending.count(node) != 0)
+            return;
+        unindex_value(node);
+        value_index->pending.insert(node);      //Even while iterating: the rebuild leaves it out
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::build_value_index () {
+        if (value_index == nullptr || iterating)
+            return;
+        value_index->nodes_of.clear();
+        value_index->position.clear();
+        value_index->position.reserve(used);
+        for (std::size_t i = next_occupied(0); i < all_bins(); i = next_occupied(i+1))
+            for (const LN* j = bin_at(i); j != nullptr; j = j->next)
+                index_value(j);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::clear_value_index () {
+        if (value_index == nullptr)
+            return;
+        value_index->nodes_of.clear();
+        value_index->position.clear();
+        value_index->pending.clear();
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::settle_value_index () {
+        if (iterating && !iterator_live()){
+            iterating = false;
+            build_value_index();
+        }
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    bool HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::pending_value (const T& value) const {
+        for (const LN* node : value_index->pending)
+            if (node->value.second == value)
+                return true;
+        return false;
     }
 
 
@@ -551,78 +1837,52 @@ namespace ics {
 //
 //Iterator class definitions
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    void HashMap<KEY,T,thash>::Iterator::advance_cursors(){
-        //if(current.second->next->next != nullptr)
-        //std::cout << "current's pair is: " << current.second->value << std::endl;
-        //if(current.second->next != nullptr && current.second->next->value.first != "")//works but something is wrong though
-        //if(current.second->next->next != nullptr)
-        if(current.second->next->value.first != "")
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::Iterator::advance_cursors(){
+        if(current.second->next != nullptr)
             current.second = current.second->next;
-        else{
-//            std::cout << ref_map->bins << std::endl;
-            for(int i = current.first + 1; i < ref_map->bins; ++i){
-                for(LN* j = ref_map->map[i]; j->next != nullptr; j = j->next){
-                    current.first = i;
-//                    std::cout << j->value << std::endl;
-                    if(j->value.first != ""){
-                        current.second = j;
-                        return;
-                    }
-                }
-            }
-            current.first = -1;
-            current.second = nullptr;
+        else
+            seek_from(current.first + 1);
+        if(shrink_at_end && current.second == nullptr){
+            shrink_at_end = false;
+            if(ref_map->ensure_shrink_threshold())
+                ref_map->iterated_at = expected_mod_count = ++ref_map->mod_count;
+        }
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::Iterator::seek_from(std::size_t bin){
+        std::size_t i = ref_map->next_occupied(bin);
+        if(i < ref_map->all_bins()){
+            current.first  = i;
+            current.second = ref_map->bin_at(i);
+            return;
         }
+        current.first = -1;
+        current.second = nullptr;
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    HashMap<KEY,T,thash>::Iterator::Iterator(HashMap<KEY,T,thash>* iterate_over, bool from_begin)
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::Iterator::Iterator(HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>* iterate_over, bool from_begin)
             : ref_map(iterate_over), expected_mod_count(ref_map->mod_count) {
         if(!from_begin || ref_map->empty()){
             current.first = -1;
             current.second = nullptr;
         }
-        else{
-            bool check = false;
-            for(int i = 0; i < ref_map->bins; ++i){
-                for(LN* j = ref_map->map[i]; j->next != nullptr;){
-                    current.first = i;
-                    current.second = j;
-                    check = true;
-                    break;
-                }
-                if(check)
-                    break;
-                //if(current.first == i)
-            }
-//            current.first = 0;
-//            current.second = ref_map->map[0];
-        }
-//        for(int i = 0; i < ref_map->bins; ++i){
-//            current.first = i;
-//            for(LN* node = ref_map->map[i]; node != nullptr; node = node->next){
-//                if(node->next != nullptr){
-//                    current.second = node;
-//                    break;
-//                }
-//            }
-//        }
-
-        //for(int i = 0; i < ref_map->bins; ++i){
-        //for(LN* node = ref_map->map[i]; node != nullptr; node = node->next)
-
+        else
+            seek_from(0);
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    HashMap<KEY,T,thash>::Iterator::~Iterator()
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::Iterator::~Iterator()
     {}
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    auto HashMap<KEY,T,thash>::Iterator::erase() -> Entry {
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    auto HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::Iterator::erase() -> Entry {
         if (expected_mod_count != ref_map->mod_count)
             throw ConcurrentModificationError("BSTMap::Iterator::erase");
         if (!can_erase)
@@ -630,28 +1890,50 @@ namespace ics {
         if (current.second == nullptr)
             throw CannotEraseError("BSTMap::Iterator::erase Iterator cursor beyond data structure");
 
+        if (ref_map->sharers.load(std::memory_order_relaxed) != nullptr){
+            //Move the cursor to the same node (same bin, same position) in ref_map's private copy
+            std::size_t position = 0;
+            for (LN* j = ref_map->bin_at(current.first); j != current.second; j = j->next)
+                ++position;
+            ref_map->unshare();
+            for (current.second = ref_map->bin_at(current.first); position > 0; --position)
+                current.second = current.second->next;
+            expected_mod_count = ref_map->mod_count;
+        }
+
         can_erase = false;
-        //if(current.second->value.first == "")
         Entry to_return = current.second->value;
-        LN* to_delete = current.second;
-        if(current.second->next->next == nullptr)
-            advance_cursors();
-        ref_map->erase(to_delete->value.first);
+        LN** link = &ref_map->bin_at(current.first);
+        if (current.first < ref_map->bins && ref_map->tree_at(current.first) != nullptr)
+            link = ref_map->find_link(current.second->value.first, current.second->hash_code, current.first);
+        else
+            while (*link != current.second)
+                link = &(*link)->next;
+        shrink_at_end = false;              //Never shrink while link is live: checked below instead
+        advance_cursors();                  //current now indexes the "next" value
+        ref_map->remove_node(*link);        //Not erase: migrating/shrinking bins would move nodes under the cursor
         expected_mod_count = ref_map->mod_count;
+        if (current.second == nullptr){
+            if (ref_map->ensure_shrink_threshold())
+                expected_mod_count = ++ref_map->mod_count;
+        }
+        else
+            shrink_at_end = true;
+        ref_map->iterated_at = expected_mod_count;  //This Iterator may still write entries
 
         return to_return;
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    std::string HashMap<KEY,T,thash>::Iterator::str() const {
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    std::string HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::Iterator::str() const {
         std::ostringstream answer;
         answer << ref_map->str() << "(expected_mod_count=" << expected_mod_count  << ",can_erase=" << can_erase << ")";
         return answer.str();
     }
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    auto  HashMap<KEY,T,thash>::Iterator::operator ++ () -> HashMap<KEY,T,thash>::Iterator& {
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    auto  HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::Iterator::operator ++ () -> HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::Iterator& {
         if (expected_mod_count != ref_map->mod_count)
             throw ConcurrentModificationError("BSTMap::Iterator::operator ++");
 
@@ -667,8 +1949,8 @@ namespace ics {
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    auto  HashMap<KEY,T,thash>::Iterator::operator ++ (int) -> HashMap<KEY,T,thash>::Iterator {
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    auto  HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::Iterator::operator ++ (int) -> HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::Iterator {
         if (expected_mod_count != ref_map->mod_count)
             throw ConcurrentModificationError("BSTMap::Iterator::operator ++");
 
@@ -685,8 +1967,8 @@ namespace ics {
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    bool HashMap<KEY,T,thash>::Iterator::operator == (const HashMap<KEY,T,thash>::Iterator& rhs) const {
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    bool HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::Iterator::operator == (const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::Iterator& rhs) const {
         const Iterator* rhsASI = dynamic_cast<const Iterator*>(&rhs);
         if (rhsASI == 0)
             throw IteratorTypeError("BSTMap::Iterator::operator ==");
@@ -699,8 +1981,8 @@ namespace ics {
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    bool HashMap<KEY,T,thash>::Iterator::operator != (const HashMap<KEY,T,thash>::Iterator& rhs) const {
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    bool HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::Iterator::operator != (const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::Iterator& rhs) const {
         const Iterator* rhsASI = dynamic_cast<const Iterator*>(&rhs);
         if (rhsASI == 0)
             throw IteratorTypeError("BSTMap::Iterator::operator !=");
@@ -713,8 +1995,8 @@ namespace ics {
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    pair<KEY,T>& HashMap<KEY,T,thash>::Iterator::operator *() const {
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    pair<KEY,T>& HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::Iterator::operator *() const {
         if (expected_mod_count != ref_map->mod_count)
             throw ConcurrentModificationError("BSTMap::Iterator::operator *");
         if (!can_erase || current.second == nullptr) {
@@ -726,11 +2008,11 @@ namespace ics {
     }
 
 
-    template<class KEY,class T, int (*thash)(const KEY& a)>
-    pair<KEY,T>* HashMap<KEY,T,thash>::Iterator::operator ->() const {
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    pair<KEY,T>* HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::Iterator::operator ->() const {
         if (expected_mod_count != ref_map->mod_count)
             throw ConcurrentModificationError("BSTMap::Iterator::operator ->");
-        if (!can_erase || current->second == nullptr) {
+        if (!can_erase || current.second == nullptr) {
             std::ostringstream where;
             where << current << " when size = " << ref_map->size();
             throw IteratorPositionIllegal("BSTMap::Iterator::operator -> Iterator illegal: " + where.str());
@@ -739,6 +2021,61 @@ namespace ics {
     }
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//ConstIterator class definitions
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::ConstIterator::ConstIterator(const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>* iterate_over, bool from_begin)
+            : i(const_cast<HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>*>(iterate_over), from_begin) {
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    std::string HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::ConstIterator::str() const {
+        return i.str();
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    auto HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::ConstIterator::operator ++ () -> HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::ConstIterator& {
+        ++i;
+        return *this;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    auto HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::ConstIterator::operator ++ (int) -> HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::ConstIterator {
+        ConstIterator to_return(*this);
+        ++i;
+        return to_return;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    bool HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::ConstIterator::operator == (const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::ConstIterator& rhs) const {
+        return i == rhs.i;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    bool HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::ConstIterator::operator != (const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::ConstIterator& rhs) const {
+        return i != rhs.i;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    const pair<KEY,T>& HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::ConstIterator::operator *() const {
+        return *i;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    const pair<KEY,T>* HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::ConstIterator::operator ->() const {
+        return i.operator ->();
+    }
+
+
 }
 
 #endif /* HASH_MAP_HPP_ */
@@ -0,0 +1,448 @@
+#ifndef HASH_MAP_SNAPSHOT_HPP_
+#define HASH_MAP_SNAPSHOT_HPP_
+
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>               //For std::rename/std::remove
+#include <type_traits>
+#include <fcntl.h>              //POSIX open/mmap: a snapshot is read in place from the page cache
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ics_exceptions.hpp"
+#include "hash_functions.hpp"
+#include "hash_map.hpp"
+
+
+namespace ics {
+
+
+//A snapshot is a HashMap written to a file in the form it is searched in, so MappedHashMap can
+//  mmap it read-only and serve lookups from the mapped pages: no parsing, no allocation, and
+//  every process mapping the same file shares one copy in the page cache. Layout (native byte
+//  order, 8-byte aligned):
+//    SnapshotHeader
+//    std::uint64_t bin_start[bins+1]    entries of bin b are entries [bin_start[b],bin_start[b+1])
+//    entries[used]                      hash code, key slot, value slot (see snapshot_codec)
+//    string bytes                       the characters of every std::string key/value
+//Keys/values must be trivially copyable (stored by value) or std::string (stored as an
+//  offset/length into the string bytes). Bins are a power of 2 located as HashMap locates them
+//  (with its hash mixing setting), from the hash codes HashMap memoized.
+    struct SnapshotHeader {
+        static const std::uint64_t magic_number = 0x3170616e5348434fULL; //Reads wrong if the byte order differs
+        static const std::uint32_t version      = 1;
+
+        std::uint64_t magic;
+        std::uint32_t format_version;
+        std::uint32_t mix_hashes;      //1 if bins come from fibonacci_mix(hash_code)
+        std::uint32_t key_kind,  key_size;
+        std::uint32_t value_kind, value_size;
+        std::uint64_t bins;
+        std::uint64_t used;
+        std::uint64_t entry_size;
+        std::uint64_t string_bytes;
+    };
+
+
+//A std::string key/value inside a mapped snapshot: points into the mapping (no copy)
+    class SnapshotString {
+    public:
+        SnapshotString (const char* d, std::size_t l) : data(d), length(l) {}
+
+        std::string str        () const                     {return std::string(data,length);}
+        bool operator ==       (const std::string& s) const {return s.size() == length && std::memcmp(s.data(), data, length) == 0;}
+        bool operator !=       (const std::string& s) const {return !(*this == s);}
+        friend std::ostream& operator << (std::ostream& outs, const SnapshotString& s) {return outs.write(s.data, s.length);}
+
+        const char* data;
+        std::size_t length;
+    };
+
+
+//How a key or value is stored in an entry's slot, and read back (as view) from the mapping.
+//kind and size are recorded in the header, so a snapshot opened with other types is rejected
+//  (unless they are trivially copyable types of the same size).
+    template<class X, bool BY_VALUE = std::is_trivially_copyable<X>::value> struct snapshot_codec {
+        static_assert(BY_VALUE, "snapshots store only trivially copyable types and std::string");
+        static_assert(alignof(X) <= 8, "snapshot slots are 8-byte aligned");
+
+        typedef const X& view;
+        static const std::uint32_t kind      = 0;
+        static const std::uint32_t size      = sizeof(X);
+        static const std::size_t   slot_size = (sizeof(X) + 7) / 8 * 8;
+
+        static std::size_t string_bytes (const X&)                              {return 0;}
+        static void  store   (char* slot, char*, std::uint64_t&, const X& x)     {std::memcpy(slot, &x, sizeof(X));}
+        static view  load    (const char* slot, const char*)                   {return *reinterpret_cast<const X*>(slot);}
+        static bool  equals  (const char* slot, const char* strings, const X& x) {return load(slot,strings) == x;}
+        static X     copy    (view v)                                          {return v;}
+        static bool  fits    (const char*, std::uint64_t)                      {return true;}
+    };
+
+    template<> struct snapshot_codec<std::string,false> {
+        typedef SnapshotString view;
+        static const std::uint32_t kind      = 1;
+        static const std::uint32_t size      = 0;
+        static const std::size_t   slot_size = 2 * sizeof(std::uint64_t);  //offset, length
+
+        static std::size_t string_bytes (const std::string& x) {return x.size();}
+
+        static void store (char* slot, char* strings, std::uint64_t& next, const std::string& x) {
+            std::uint64_t offset_length[2] = {next, x.size()};
+            std::memcpy(slot, offset_length, sizeof(offset_length));
+            std::memcpy(strings + next, x.data(), x.size());
+            next += x.size();
+        }
+
+        static view load (const char* slot, const char* strings) {
+            const std::uint64_t* offset_length = reinterpret_cast<const std::uint64_t*>(slot);
+            return SnapshotString(strings + offset_length[0], offset_length[1]);
+        }
+
+        static bool        equals (const char* slot, const char* strings, const std::string& x) {return load(slot,strings) == x;}
+        static std::string copy   (view v) {return v.str();}
+
+        //Whether the slot's characters lie inside string bytes of length string_bytes
+        static bool fits (const char* slot, std::uint64_t string_bytes) {
+            std::uint64_t offset_length[2];
+            std::memcpy(offset_length, slot, sizeof(offset_length));
+            return offset_length[0] <= string_bytes && offset_length[1] <= string_bytes - offset_length[0];
+        }
+    };
+
+
+//Write m to file_name as a snapshot. The file is built under file_name+".tmp" and renamed
+//  over file_name once complete, so a reader never maps a partly written snapshot.
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void write_snapshot (const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>& m, const std::string& file_name);
+
+
+//A read-only HashMap served from a mapped snapshot. The hashing template/constructor rules
+//  are HashMap's, and the hash must be the one the snapshot was written with: it is checked
+//  (on one entry) when the file is opened.
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a) = undefinedhash<KEY>,
+             class HASH = FunctionPointerHash<KEY,thash>> class MappedHashMap {
+    public:
+        typedef snapshot_codec<KEY>            KeyCodec;
+        typedef snapshot_codec<T>              ValueCodec;
+        typedef typename KeyCodec::view        KeyView;
+        typedef typename ValueCodec::view      ValueView;
+
+        //Destructor/Constructors (unmaps the file)
+        ~MappedHashMap();
+
+        explicit MappedHashMap (const std::string& file_name, std::size_t (*chash)(const KEY& a) = undefinedhash<KEY>);
+        MappedHashMap (const MappedHashMap&)             = delete;
+        MappedHashMap& operator = (const MappedHashMap&) = delete;
+
+
+        //Queries
+        bool        empty   () const;
+        std::size_t size    () const;
+        bool        has_key (const KEY& key) const;
+        bool        get     (const KEY& key, T& value) const;   //Copies key's value into value; false if key is absent
+        std::string str     () const; //supplies useful debugging information
+
+        //Calls f(KeyView,ValueView) for every entry, in bin order
+        template<class F>
+        void for_each (F f) const;
+
+
+        //Operators
+        ValueView operator [] (const KEY& key) const;    //Points into the mapping; throws KeyError if absent
+
+
+    private:
+        HASH                 hash;          //Hashing policy used (from template or constructor)
+        const char*          mapping = nullptr;
+        std::size_t          mapped_bytes;
+        const SnapshotHeader* header;
+        const std::uint64_t* bin_start;
+        const char*          entries;
+        const char*          strings;
+
+        //Helper methods
+        static std::size_t entry_size () {return sizeof(std::uint64_t) + KeyCodec::slot_size + ValueCodec::slot_size;}
+        const char* entry      (std::uint64_t i)  const {return entries + i*entry_size();}
+        const char* key_slot   (const char* e)    const {return e + sizeof(std::uint64_t);}
+        const char* value_slot (const char* e)    const {return e + sizeof(std::uint64_t) + KeyCodec::slot_size;}
+        const char* find_entry (const KEY& key)   const; //Entry holding key, or nullptr
+        void        check_format (const std::string& file_name) const; //Throws IcsError unless every offset stays inside the mapping
+    };
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//write_snapshot definition
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), template<class> class ALLOC, class HASH, class EQUALS>
+    void write_snapshot (const HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>& m, const std::string& file_name) {
+        typedef snapshot_codec<KEY> KeyCodec;
+        typedef snapshot_codec<T>   ValueCodec;
+        typedef typename HashMap<KEY,T,thash,ALLOC,HASH,EQUALS>::LN LN;
+
+        //Pass 1: count the entries of each (snapshot) bin and the string bytes
+        SnapshotHeader h;
+        std::memset(&h, 0, sizeof(h));
+        h.magic          = SnapshotHeader::magic_number;
+        h.format_version = SnapshotHeader::version;
+        h.mix_hashes     = m.mix_hashes ? 1 : 0;
+        h.key_kind       = KeyCodec::kind;
+        h.key_size       = KeyCodec::size;
+        h.value_kind     = ValueCodec::kind;
+        h.value_size     = ValueCodec::size;
+        h.bins           = m.bins;
+        h.used           = m.used;
+        h.entry_size     = sizeof(std::uint64_t) + KeyCodec::slot_size + ValueCodec::slot_size;
+
+        std::uint64_t* bin_start = new std::uint64_t[h.bins+1]();
+        for (std::size_t i = 0; i < m.all_bins(); ++i)
+            for (LN* j = m.bin_at(i); j != nullptr; j = j->next) {
+                ++bin_start[m.bin_of(j->hash_code) + 1];
+                h.string_bytes += KeyCodec::string_bytes(j->value.first) + ValueCodec::string_bytes(j->value.second);
+            }
+        for (std::size_t b = 0; b < h.bins; ++b)
+            bin_start[b+1] += bin_start[b];
+
+        std::size_t bin_bytes   = (h.bins+1) * sizeof(std::uint64_t);
+        std::size_t entry_bytes = h.used * h.entry_size;
+        std::size_t total       = sizeof(SnapshotHeader) + bin_bytes + entry_bytes + h.string_bytes;
+
+        //Pass 2: place every entry straight into the (mapped) file
+        std::string temp_name = file_name + ".tmp";
+        int fd = ::open(temp_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || ::ftruncate(fd, total) != 0) {
+            delete [] bin_start;
+            if (fd >= 0) {
+                ::close(fd);
+                std::remove(temp_name.c_str());
+            }
+            throw FileOpenError("write_snapshot: cannot create " + temp_name);
+        }
+        char* file = static_cast<char*>(::mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+        ::close(fd);
+        if (file == MAP_FAILED) {
+            delete [] bin_start;
+            std::remove(temp_name.c_str());
+            throw FileOpenError("write_snapshot: cannot map " + temp_name);
+        }
+
+        std::memcpy(file, &h, sizeof(h));
+        std::memcpy(file + sizeof(h), bin_start, bin_bytes);
+        char* entries = file + sizeof(h) + bin_bytes;
+        char* strings = entries + entry_bytes;
+        std::uint64_t next_string = 0;
+        for (std::size_t i = 0; i < m.all_bins(); ++i)
+            for (LN* j = m.bin_at(i); j != nullptr; j = j->next) {
+                char* e = entries + bin_start[m.bin_of(j->hash_code)]++ * h.entry_size;
+                std::uint64_t hash_code = j->hash_code;
+                std::memcpy(e, &hash_code, sizeof(hash_code));
+                KeyCodec  ::store(e + sizeof(std::uint64_t),                      strings, next_string, j->value.first);
+                ValueCodec::store(e + sizeof(std::uint64_t) + KeyCodec::slot_size, strings, next_string, j->value.second);
+            }
+        delete [] bin_start;
+
+        bool written = ::msync(file, total, MS_SYNC) == 0;
+        ::munmap(file, total);
+        if (!written || std::rename(temp_name.c_str(), file_name.c_str()) != 0) {
+            std::remove(temp_name.c_str());
+            throw FileOpenError("write_snapshot: cannot write " + file_name);
+        }
+    }
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//MappedHashMap class and related definitions
+
+//Destructor/Constructors
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH>
+    MappedHashMap<KEY,T,thash,HASH>::~MappedHashMap() {
+        ::munmap(const_cast<char*>(mapping), mapped_bytes);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH>
+    MappedHashMap<KEY,T,thash,HASH>::MappedHashMap(const std::string& file_name, std::size_t (*chash)(const KEY& k))
+            : hash(hash_policy_traits<HASH>::make(chash)) {
+        hash_policy_traits<HASH>::check(hash, chash, "MappedHashMap::constructor");
+
+        int fd = ::open(file_name.c_str(), O_RDONLY);
+        struct stat file_stat;
+        if (fd < 0 || ::fstat(fd, &file_stat) != 0 || (std::size_t)file_stat.st_size < sizeof(SnapshotHeader)) {
+            if (fd >= 0)
+                ::close(fd);
+            throw FileOpenError("MappedHashMap::constructor: cannot open snapshot " + file_name);
+        }
+        mapped_bytes = file_stat.st_size;
+        void* m = ::mmap(nullptr, mapped_bytes, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (m == MAP_FAILED)
+            throw FileOpenError("MappedHashMap::constructor: cannot map snapshot " + file_name);
+        mapping   = static_cast<const char*>(m);
+        header    = reinterpret_cast<const SnapshotHeader*>(mapping);
+        bin_start = reinterpret_cast<const std::uint64_t*>(mapping + sizeof(SnapshotHeader));
+        try {
+            check_format(file_name);
+        } catch (...) {
+            ::munmap(const_cast<char*>(mapping), mapped_bytes);
+            throw;
+        }
+        entries   = reinterpret_cast<const char*>(bin_start + header->bins + 1);
+        strings   = entries + header->used * entry_size();
+        ::madvise(const_cast<char*>(mapping), mapped_bytes, MADV_RANDOM);   //Lookups touch single pages: no readahead
+
+        if (header->used > 0) {
+            const char* e = entry(0);
+            std::uint64_t stored;
+            std::memcpy(&stored, e, sizeof(stored));
+            if (stored != hash(KeyCodec::copy(KeyCodec::load(key_slot(e), strings)))) {
+                ::munmap(const_cast<char*>(mapping), mapped_bytes);
+                throw TemplateFunctionError("MappedHashMap::constructor: " + file_name + " was written with a different hash");
+            }
+        }
+    }
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//Queries
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH>
+    bool MappedHashMap<KEY,T,thash,HASH>::empty() const {
+        return size() == 0;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH>
+    std::size_t MappedHashMap<KEY,T,thash,HASH>::size() const {
+        return header->used;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH>
+    bool MappedHashMap<KEY,T,thash,HASH>::has_key (const KEY& key) const {
+        return find_entry(key) != nullptr;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH>
+    bool MappedHashMap<KEY,T,thash,HASH>::get (const KEY& key, T& value) const {
+        const char* e = find_entry(key);
+        if (e == nullptr)
+            return false;
+        value = ValueCodec::copy(ValueCodec::load(value_slot(e), strings));
+        return true;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH>
+    std::string MappedHashMap<KEY,T,thash,HASH>::str() const {
+        std::ostringstream answer;
+        answer << "mapped_hash_map[bins=" << header->bins << ",used=" << header->used << "]";
+        for_each([&answer](KeyView k, ValueView v) {answer << k << "->" << v;});
+        return answer.str();
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH>
+    template<class F>
+    void MappedHashMap<KEY,T,thash,HASH>::for_each (F f) const {
+        for (std::uint64_t i = 0; i < header->used; ++i) {
+            const char* e = entry(i);
+            f(KeyCodec::load(key_slot(e), strings), ValueCodec::load(value_slot(e), strings));
+        }
+    }
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//Operators
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH>
+    typename MappedHashMap<KEY,T,thash,HASH>::ValueView MappedHashMap<KEY,T,thash,HASH>::operator [] (const KEY& key) const {
+        const char* e = find_entry(key);
+        if (e != nullptr)
+            return ValueCodec::load(value_slot(e), strings);
+
+        std::ostringstream answer;
+        answer << "MappedHashMap::operator []: key(" << key << ") not in Map";
+        throw KeyError(answer.str());
+    }
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//Private helper methods
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH>
+    const char* MappedHashMap<KEY,T,thash,HASH>::find_entry (const KEY& key) const {
+        std::uint64_t hash_code = hash(key);
+        std::uint64_t bin       = (header->mix_hashes ? fibonacci_mix(hash_code) : hash_code) & (header->bins - 1);
+        for (std::uint64_t i = bin_start[bin]; i < bin_start[bin+1]; ++i) {
+            const char* e = entry(i);
+            std::uint64_t stored;
+            std::memcpy(&stored, e, sizeof(stored));
+            if (stored == hash_code && KeyCodec::equals(key_slot(e), strings, key))
+                return e;
+        }
+        return nullptr;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH>
+    void MappedHashMap<KEY,T,thash,HASH>::check_format (const std::string& file_name) const {
+        std::string problem;
+        if (header->magic != SnapshotHeader::magic_number)
+            problem = "not a snapshot (or written with another byte order)";
+        else if (header->format_version != SnapshotHeader::version)
+            problem = "unsupported snapshot version";
+        else if (header->key_kind != KeyCodec::kind || header->key_size != KeyCodec::size ||
+                 header->value_kind != ValueCodec::kind || header->value_size != ValueCodec::size)
+            problem = "written for other KEY/T types";
+        else if (header->bins == 0 || (header->bins & (header->bins - 1)) != 0 || header->entry_size != entry_size())
+            problem = "corrupt header";
+        if (!problem.empty())
+            throw IcsError("MappedHashMap::constructor: " + file_name + ": " + problem);
+
+        //Each section must fit in what is left of the file (compared by division: no overflow)
+        std::uint64_t left = mapped_bytes - sizeof(SnapshotHeader);
+        if (header->bins >= left / sizeof(std::uint64_t))
+            problem = "truncated bins";
+        else {
+            left -= (header->bins+1) * sizeof(std::uint64_t);
+            if (header->used > left / entry_size())
+                problem = "truncated entries";
+            else if (left - header->used * entry_size() != header->string_bytes)
+                problem = "truncated or corrupt strings";
+        }
+        if (!problem.empty())
+            throw IcsError("MappedHashMap::constructor: " + file_name + ": " + problem);
+
+        //Bins must partition [0,used) in order, and every string lie inside the string bytes
+        if (bin_start[0] != 0 || bin_start[header->bins] != header->used)
+            problem = "corrupt bins";
+        for (std::uint64_t b = 0; problem.empty() && b < header->bins; ++b)
+            if (bin_start[b] > bin_start[b+1])
+                problem = "corrupt bins";
+        const char* e = reinterpret_cast<const char*>(bin_start + header->bins + 1);
+        for (std::uint64_t i = 0; problem.empty() && i < header->used; ++i, e += entry_size())
+            if (!KeyCodec::fits(key_slot(e), header->string_bytes) || !ValueCodec::fits(value_slot(e), header->string_bytes))
+                problem = "corrupt strings";
+        if (!problem.empty())
+            throw IcsError("MappedHashMap::constructor: " + file_name + ": " + problem);
+    }
+
+
+}
+
+#endif /* HASH_MAP_SNAPSHOT_HPP_ */
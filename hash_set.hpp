@@ -7,42 +7,40 @@
 #include <initializer_list>
 #include "ics_exceptions.hpp"
 #include "pair.hpp"
+#include "node_allocator.hpp"
+#include "hash_functions.hpp"
 
 
 namespace ics {
 
 
-#ifndef undefinedhashdefined
-#define undefinedhashdefined
-template<class T>
-int undefinedhash (const T& a) {return 0;}
-#endif /* undefinedhashdefined */
-
-//Instantiate the templated class supplying thash(a): produces a hash value for a.
+//Instantiate the templated class supplying thash(a): produces a (std::size_t) hash value for a.
 //If thash is defaulted to undefinedhash in the template, then a constructor must supply chash.
 //If both thash and chash are supplied, then they must be the same (by ==) function.
 //If neither is supplied, or both are supplied but different, TemplateFunctionError is raised.
 //The (unique) non-undefinedhash value supplied by thash/chash is stored in the instance variable hash.
-template<class T, int (*thash)(const T& a) = undefinedhash<T>> class HashSet {
+//HASH/EQUALS are the hash and element-equality policies (see hash_functions.hpp and HashMap).
+template<class T, std::size_t (*thash)(const T& a) = undefinedhash<T>, template<class> class ALLOC = HeapNodeAllocator,
+         class HASH = FunctionPointerHash<T,thash>, class EQUALS = std::equal_to<T>> class HashSet {
   public:
-    typedef int (*hashfunc) (const T& a);
+    typedef std::size_t (*hashfunc) (const T& a);
 
     //Destructor/Constructors
     ~HashSet ();
 
-    HashSet (double the_load_threshold = 1.0, int (*chash)(const T& a) = undefinedhash<T>);
-    explicit HashSet (int initial_bins, double the_load_threshold = 1.0, int (*chash)(const T& k) = undefinedhash<T>);
-    HashSet (const HashSet<T,thash>& to_copy, double the_load_threshold = 1.0, int (*chash)(const T& a) = undefinedhash<T>);
-    explicit HashSet (const std::initializer_list<T>& il, double the_load_threshold = 1.0, int (*chash)(const T& a) = undefinedhash<T>);
+    HashSet (double the_load_threshold = 1.0, std::size_t (*chash)(const T& a) = undefinedhash<T>);
+    explicit HashSet (int initial_bins, double the_load_threshold = 1.0, std::size_t (*chash)(const T& k) = undefinedhash<T>);
+    HashSet (const HashSet<T,thash,ALLOC,HASH,EQUALS>& to_copy, double the_load_threshold = 1.0, std::size_t (*chash)(const T& a) = undefinedhash<T>);
+    explicit HashSet (const std::initializer_list<T>& il, double the_load_threshold = 1.0, std::size_t (*chash)(const T& a) = undefinedhash<T>);
 
     //Iterable class must support "for-each" loop: .begin()/.end() and prefix ++ on returned result
     template <class Iterable>
-    explicit HashSet (const Iterable& i, double the_load_threshold = 1.0, int (*chash)(const T& a) = undefinedhash<T>);
+    explicit HashSet (const Iterable& i, double the_load_threshold = 1.0, std::size_t (*chash)(const T& a) = undefinedhash<T>);
 
 
     //Queries
     bool empty      () const;
-    int  size       () const;
+    std::size_t size () const;
     bool contains   (const T& element) const;
     std::string str () const; //supplies useful debugging information; contrast to operator <<
 
@@ -59,26 +57,26 @@ template<class T, int (*thash)(const T& a) = undefinedhash<T>> class HashSet {
     //Iterable class must support "for" loop: .begin()/.end() and prefix ++ on returned result
 
     template <class Iterable>
-    int insert_all(const Iterable& i);
+    std::size_t insert_all(const Iterable& i);
 
     template <class Iterable>
-    int erase_all(const Iterable& i);
+    std::size_t erase_all(const Iterable& i);
 
     template<class Iterable>
-    int retain_all(const Iterable& i);
+    std::size_t retain_all(const Iterable& i);
 
 
     //Operators
-    HashSet<T,thash>& operator = (const HashSet<T,thash>& rhs);
-    bool operator == (const HashSet<T,thash>& rhs) const;
-    bool operator != (const HashSet<T,thash>& rhs) const;
-    bool operator <= (const HashSet<T,thash>& rhs) const;
-    bool operator <  (const HashSet<T,thash>& rhs) const;
-    bool operator >= (const HashSet<T,thash>& rhs) const;
-    bool operator >  (const HashSet<T,thash>& rhs) const;
+    HashSet<T,thash,ALLOC,HASH,EQUALS>& operator = (const HashSet<T,thash,ALLOC,HASH,EQUALS>& rhs);
+    bool operator == (const HashSet<T,thash,ALLOC,HASH,EQUALS>& rhs) const;
+    bool operator != (const HashSet<T,thash,ALLOC,HASH,EQUALS>& rhs) const;
+    bool operator <= (const HashSet<T,thash,ALLOC,HASH,EQUALS>& rhs) const;
+    bool operator <  (const HashSet<T,thash,ALLOC,HASH,EQUALS>& rhs) const;
+    bool operator >= (const HashSet<T,thash,ALLOC,HASH,EQUALS>& rhs) const;
+    bool operator >  (const HashSet<T,thash,ALLOC,HASH,EQUALS>& rhs) const;
 
-    template<class T2, int (*hash2)(const T2& a)>
-    friend std::ostream& operator << (std::ostream& outs, const HashSet<T2,hash2>& s);
+    template<class T2, std::size_t (*hash2)(const T2& a), template<class> class ALLOC2, class HASH2, class EQUALS2>
+    friend std::ostream& operator << (std::ostream& outs, const HashSet<T2,hash2,ALLOC2,HASH2,EQUALS2>& s);
 
 
 
@@ -88,37 +86,37 @@ template<class T, int (*thash)(const T& a) = undefinedhash<T>> class HashSet {
   public:
     class Iterator {
       public:
-        typedef pair<int,LN*> Cursor;
+        typedef pair<std::size_t,LN*> Cursor;
 
-        //Private constructor called in begin/end, which are friends of HashSet<T,thash>
+        //Private constructor called in begin/end, which are friends of HashSet<T,thash,ALLOC,HASH,EQUALS>
         ~Iterator();
         T           erase();
         std::string str  () const;
-        HashSet<T,thash>::Iterator& operator ++ ();
-        HashSet<T,thash>::Iterator  operator ++ (int);
-        bool operator == (const HashSet<T,thash>::Iterator& rhs) const;
-        bool operator != (const HashSet<T,thash>::Iterator& rhs) const;
+        HashSet<T,thash,ALLOC,HASH,EQUALS>::Iterator& operator ++ ();
+        HashSet<T,thash,ALLOC,HASH,EQUALS>::Iterator  operator ++ (int);
+        bool operator == (const HashSet<T,thash,ALLOC,HASH,EQUALS>::Iterator& rhs) const;
+        bool operator != (const HashSet<T,thash,ALLOC,HASH,EQUALS>::Iterator& rhs) const;
         T& operator *  () const;
         T* operator -> () const;
-        friend std::ostream& operator << (std::ostream& outs, const HashSet<T,thash>::Iterator& i) {
+        friend std::ostream& operator << (std::ostream& outs, const HashSet<T,thash,ALLOC,HASH,EQUALS>::Iterator& i) {
           outs << i.str(); //Use the same meaning as the debugging .str() method
           return outs;
         }
-        friend Iterator HashSet<T,thash>::begin () const;
-        friend Iterator HashSet<T,thash>::end   () const;
+        friend Iterator HashSet<T,thash,ALLOC,HASH,EQUALS>::begin () const;
+        friend Iterator HashSet<T,thash,ALLOC,HASH,EQUALS>::end   () const;
 
       private:
         //If can_erase is false, current indexes the "next" value (must ++ to reach it)
         Cursor              current; //Pair:Bin Index/LN*; stops if LN* == nullptr
-        HashSet<T,thash>*   ref_set;
-        int                 expected_mod_count;
+        HashSet<T,thash,ALLOC,HASH,EQUALS>*   ref_set;
+        std::size_t         expected_mod_count;
         bool                can_erase = true;
 
         //Helper methods
         void advance_cursors();
 
         //Called in friends begin/end
-        Iterator(HashSet<T,thash>* iterate_over, bool from_begin);
+        Iterator(HashSet<T,thash,ALLOC,HASH,EQUALS>* iterate_over, bool from_begin);
     };
 
 
@@ -129,32 +127,35 @@ template<class T, int (*thash)(const T& a) = undefinedhash<T>> class HashSet {
   private:
     class LN {
       public:
-        LN ()                      {}
-        LN (const LN& ln)          : value(ln.value), next(ln.next){}
-        LN (T v,  LN* n = nullptr) : value(v), next(n){}
+        LN ()                             {}
+        LN (const LN& ln)                 : value(ln.value), hash_code(ln.hash_code), next(ln.next){}
+        LN (T v, std::size_t h, LN* n = nullptr)  : value(v), hash_code(h), next(n){}
 
         T   value;
-        LN* next   = nullptr;
+        std::size_t hash_code = 0;  //hash(value), memoized: compared before elements, reused when resizing
+        LN* next      = nullptr;
     };
 
 public:
-  int (*hash)(const T& k);   //Hashing function used (from template or constructor)
+  HASH   hash;               //Hashing policy used (from template or constructor)
+  EQUALS equals;             //Element equality policy used
 private:
-  LN** set      = nullptr;   //Pointer to array of pointers: each bin stores a list with a trailer node
+  LN** set      = nullptr;   //Pointer to array of pointers: each bin stores a list (nullptr if empty)
   double load_threshold;     //used/bins <= load_threshold
-  int bins      = 1;         //# bins currently in array (start it >= 1 so no divide by 0 in hash_compress)
-  int used      = 0;         //Cache for number of elements in the hash table
-  int mod_count = 0;         //For sensing concurrent modification
+  std::size_t bins      = 1; //# bins currently in array (start it >= 1 so no divide by 0 in hash_compress)
+  std::size_t used      = 0; //Cache for number of elements in the hash table
+  std::size_t mod_count = 0; //For sensing concurrent modification
 
 
   //Helper methods
-  int   hash_compress        (const T& element)          const;  //hash function ranged to [0,bins-1]
-  LN*   find_element         (const T& element)          const;  //Returns reference to element's node or nullptr
+  std::size_t hash_compress  (const T& element)          const;  //hash function ranged to [0,bins-1]
+  std::size_t bin_of         (std::size_t hash_code)     const;  //hash_compress for an already computed hash
+  LN*   find_element         (const T& element, std::size_t hash_code, std::size_t bin) const; //Returns reference to element's node in bin or nullptr
   LN*   copy_list            (LN*   l)                   const;  //Copy the elements in a bin (order irrelevant)
-  LN**  copy_hash_table      (LN** ht, int bins)         const;  //Copy the bins/keys/values in ht (order in bins irrelevant)
+  LN**  copy_hash_table      (LN** ht, std::size_t bins) const;  //Copy the bins/keys/values in ht (order in bins irrelevant)
 
-  void  ensure_load_threshold(int new_used);                     //Reallocate if load_threshold > load_threshold
-  void  delete_hash_table    (LN**& ht, int bins);               //Deallocate all LN in ht (and the ht itself; ht == nullptr)
+  void  ensure_load_threshold(std::size_t new_used);             //Reallocate if load_threshold > load_threshold
+  void  delete_hash_table    (LN**& ht, std::size_t bins);       //Deallocate all LN in ht (and the ht itself; ht == nullptr)
 };
 
 
@@ -167,37 +168,37 @@ private:
 //
 //Destructor/Constructors
 
-template<class T, int (*thash)(const T& a)>
-HashSet<T,thash>::~HashSet() {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+HashSet<T,thash,ALLOC,HASH,EQUALS>::~HashSet() {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-HashSet<T,thash>::HashSet(double the_load_threshold, int (*chash)(const T& element))
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+HashSet<T,thash,ALLOC,HASH,EQUALS>::HashSet(double the_load_threshold, std::size_t (*chash)(const T& element))
 }
 
 
-template<class T, int (*thash)(const T& a)>
-HashSet<T,thash>::HashSet(int initial_bins, double the_load_threshold, int (*chash)(const T& element))
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+HashSet<T,thash,ALLOC,HASH,EQUALS>::HashSet(int initial_bins, double the_load_threshold, std::size_t (*chash)(const T& element))
 {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-HashSet<T,thash>::HashSet(const HashSet<T,thash>& to_copy, double the_load_threshold, int (*chash)(const T& element))
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+HashSet<T,thash,ALLOC,HASH,EQUALS>::HashSet(const HashSet<T,thash,ALLOC,HASH,EQUALS>& to_copy, double the_load_threshold, std::size_t (*chash)(const T& element))
 {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-HashSet<T,thash>::HashSet(const std::initializer_list<T>& il, double the_load_threshold, int (*chash)(const T& element))
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+HashSet<T,thash,ALLOC,HASH,EQUALS>::HashSet(const std::initializer_list<T>& il, double the_load_threshold, std::size_t (*chash)(const T& element))
 {
 }
 
 
-template<class T, int (*thash)(const T& a)>
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
 template<class Iterable>
-HashSet<T,thash>::HashSet(const Iterable& i, double the_load_threshold, int (*chash)(const T& a))
+HashSet<T,thash,ALLOC,HASH,EQUALS>::HashSet(const Iterable& i, double the_load_threshold, std::size_t (*chash)(const T& a))
 {
 }
 
@@ -206,29 +207,29 @@ HashSet<T,thash>::HashSet(const Iterable& i, double the_load_threshold, int (*ch
 //
 //Queries
 
-template<class T, int (*thash)(const T& a)>
-bool HashSet<T,thash>::empty() const {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+bool HashSet<T,thash,ALLOC,HASH,EQUALS>::empty() const {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-int HashSet<T,thash>::size() const {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+std::size_t HashSet<T,thash,ALLOC,HASH,EQUALS>::size() const {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-bool HashSet<T,thash>::contains (const T& element) const {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+bool HashSet<T,thash,ALLOC,HASH,EQUALS>::contains (const T& element) const {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-std::string HashSet<T,thash>::str() const {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+std::string HashSet<T,thash,ALLOC,HASH,EQUALS>::str() const {
 }
 
 
-template<class T, int (*thash)(const T& a)>
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
 template <class Iterable>
-bool HashSet<T,thash>::contains_all(const Iterable& i) const {
+bool HashSet<T,thash,ALLOC,HASH,EQUALS>::contains_all(const Iterable& i) const {
 }
 
 
@@ -236,36 +237,36 @@ bool HashSet<T,thash>::contains_all(const Iterable& i) const {
 //
 //Commands
 
-template<class T, int (*thash)(const T& a)>
-int HashSet<T,thash>::insert(const T& element) {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+int HashSet<T,thash,ALLOC,HASH,EQUALS>::insert(const T& element) {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-int HashSet<T,thash>::erase(const T& element) {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+int HashSet<T,thash,ALLOC,HASH,EQUALS>::erase(const T& element) {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-void HashSet<T,thash>::clear() {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+void HashSet<T,thash,ALLOC,HASH,EQUALS>::clear() {
 }
 
 
-template<class T, int (*thash)(const T& a)>
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
 template<class Iterable>
-int HashSet<T,thash>::insert_all(const Iterable& i) {
+std::size_t HashSet<T,thash,ALLOC,HASH,EQUALS>::insert_all(const Iterable& i) {
 }
 
 
-template<class T, int (*thash)(const T& a)>
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
 template<class Iterable>
-int HashSet<T,thash>::erase_all(const Iterable& i) {
+std::size_t HashSet<T,thash,ALLOC,HASH,EQUALS>::erase_all(const Iterable& i) {
 }
 
 
-template<class T, int (*thash)(const T& a)>
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
 template<class Iterable>
-int HashSet<T,thash>::retain_all(const Iterable& i) {
+std::size_t HashSet<T,thash,ALLOC,HASH,EQUALS>::retain_all(const Iterable& i) {
 }
 
 
@@ -273,42 +274,42 @@ int HashSet<T,thash>::retain_all(const Iterable& i) {
 //
 //Operators
 
-template<class T, int (*thash)(const T& a)>
-HashSet<T,thash>& HashSet<T,thash>::operator = (const HashSet<T,thash>& rhs) {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+HashSet<T,thash,ALLOC,HASH,EQUALS>& HashSet<T,thash,ALLOC,HASH,EQUALS>::operator = (const HashSet<T,thash,ALLOC,HASH,EQUALS>& rhs) {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-bool HashSet<T,thash>::operator == (const HashSet<T,thash>& rhs) const {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+bool HashSet<T,thash,ALLOC,HASH,EQUALS>::operator == (const HashSet<T,thash,ALLOC,HASH,EQUALS>& rhs) const {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-bool HashSet<T,thash>::operator != (const HashSet<T,thash>& rhs) const {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+bool HashSet<T,thash,ALLOC,HASH,EQUALS>::operator != (const HashSet<T,thash,ALLOC,HASH,EQUALS>& rhs) const {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-bool HashSet<T,thash>::operator <= (const HashSet<T,thash>& rhs) const {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+bool HashSet<T,thash,ALLOC,HASH,EQUALS>::operator <= (const HashSet<T,thash,ALLOC,HASH,EQUALS>& rhs) const {
 }
 
-template<class T, int (*thash)(const T& a)>
-bool HashSet<T,thash>::operator < (const HashSet<T,thash>& rhs) const {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+bool HashSet<T,thash,ALLOC,HASH,EQUALS>::operator < (const HashSet<T,thash,ALLOC,HASH,EQUALS>& rhs) const {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-bool HashSet<T,thash>::operator >= (const HashSet<T,thash>& rhs) const {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+bool HashSet<T,thash,ALLOC,HASH,EQUALS>::operator >= (const HashSet<T,thash,ALLOC,HASH,EQUALS>& rhs) const {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-bool HashSet<T,thash>::operator > (const HashSet<T,thash>& rhs) const {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+bool HashSet<T,thash,ALLOC,HASH,EQUALS>::operator > (const HashSet<T,thash,ALLOC,HASH,EQUALS>& rhs) const {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-std::ostream& operator << (std::ostream& outs, const HashSet<T,thash>& s) {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+std::ostream& operator << (std::ostream& outs, const HashSet<T,thash,ALLOC,HASH,EQUALS>& s) {
 }
 
 
@@ -316,13 +317,13 @@ std::ostream& operator << (std::ostream& outs, const HashSet<T,thash>& s) {
 //
 //Iterator constructors
 
-template<class T, int (*thash)(const T& a)>
-auto HashSet<T,thash>::begin () const -> HashSet<T,thash>::Iterator {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+auto HashSet<T,thash,ALLOC,HASH,EQUALS>::begin () const -> HashSet<T,thash,ALLOC,HASH,EQUALS>::Iterator {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-auto HashSet<T,thash>::end () const -> HashSet<T,thash>::Iterator {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+auto HashSet<T,thash,ALLOC,HASH,EQUALS>::end () const -> HashSet<T,thash,ALLOC,HASH,EQUALS>::Iterator {
 }
 
 
@@ -330,32 +331,37 @@ auto HashSet<T,thash>::end () const -> HashSet<T,thash>::Iterator {
 //
 //Private helper methods
 
-template<class T, int (*thash)(const T& a)>
-int HashSet<T,thash>::hash_compress (const T& element) const {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+std::size_t HashSet<T,thash,ALLOC,HASH,EQUALS>::hash_compress (const T& element) const {
+}
+
+
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+std::size_t HashSet<T,thash,ALLOC,HASH,EQUALS>::bin_of (std::size_t hash_code) const {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-typename HashSet<T,thash>::LN* HashSet<T,thash>::find_element (const T& element) const {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+typename HashSet<T,thash,ALLOC,HASH,EQUALS>::LN* HashSet<T,thash,ALLOC,HASH,EQUALS>::find_element (const T& element, std::size_t hash_code, std::size_t bin) const {
 }
 
-template<class T, int (*thash)(const T& a)>
-typename HashSet<T,thash>::LN* HashSet<T,thash>::copy_list (LN* l) const {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+typename HashSet<T,thash,ALLOC,HASH,EQUALS>::LN* HashSet<T,thash,ALLOC,HASH,EQUALS>::copy_list (LN* l) const {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-typename HashSet<T,thash>::LN** HashSet<T,thash>::copy_hash_table (LN** ht, int bins) const {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+typename HashSet<T,thash,ALLOC,HASH,EQUALS>::LN** HashSet<T,thash,ALLOC,HASH,EQUALS>::copy_hash_table (LN** ht, std::size_t bins) const {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-void HashSet<T,thash>::ensure_load_threshold(int new_used) {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+void HashSet<T,thash,ALLOC,HASH,EQUALS>::ensure_load_threshold(std::size_t new_used) {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-void HashSet<T,thash>::delete_hash_table (LN**& ht, int bins) {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+void HashSet<T,thash,ALLOC,HASH,EQUALS>::delete_hash_table (LN**& ht, std::size_t bins) {
 }
 
 
@@ -367,57 +373,57 @@ void HashSet<T,thash>::delete_hash_table (LN**& ht, int bins) {
 //
 //Iterator class definitions
 
-template<class T, int (*thash)(const T& a)>
-void HashSet<T,thash>::Iterator::advance_cursors() {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+void HashSet<T,thash,ALLOC,HASH,EQUALS>::Iterator::advance_cursors() {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-HashSet<T,thash>::Iterator::Iterator(HashSet<T,thash>* iterate_over, bool begin)
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+HashSet<T,thash,ALLOC,HASH,EQUALS>::Iterator::Iterator(HashSet<T,thash,ALLOC,HASH,EQUALS>* iterate_over, bool begin)
 {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-HashSet<T,thash>::Iterator::~Iterator()
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+HashSet<T,thash,ALLOC,HASH,EQUALS>::Iterator::~Iterator()
 {}
 
 
-template<class T, int (*thash)(const T& a)>
-T HashSet<T,thash>::Iterator::erase() {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+T HashSet<T,thash,ALLOC,HASH,EQUALS>::Iterator::erase() {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-std::string HashSet<T,thash>::Iterator::str() const {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+std::string HashSet<T,thash,ALLOC,HASH,EQUALS>::Iterator::str() const {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-auto  HashSet<T,thash>::Iterator::operator ++ () -> HashSet<T,thash>::Iterator& {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+auto  HashSet<T,thash,ALLOC,HASH,EQUALS>::Iterator::operator ++ () -> HashSet<T,thash,ALLOC,HASH,EQUALS>::Iterator& {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-auto  HashSet<T,thash>::Iterator::operator ++ (int) -> HashSet<T,thash>::Iterator {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+auto  HashSet<T,thash,ALLOC,HASH,EQUALS>::Iterator::operator ++ (int) -> HashSet<T,thash,ALLOC,HASH,EQUALS>::Iterator {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-bool HashSet<T,thash>::Iterator::operator == (const HashSet<T,thash>::Iterator& rhs) const {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+bool HashSet<T,thash,ALLOC,HASH,EQUALS>::Iterator::operator == (const HashSet<T,thash,ALLOC,HASH,EQUALS>::Iterator& rhs) const {
 }
 
 
-template<class T, int (*thash)(const T& a)>
-bool HashSet<T,thash>::Iterator::operator != (const HashSet<T,thash>::Iterator& rhs) const {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+bool HashSet<T,thash,ALLOC,HASH,EQUALS>::Iterator::operator != (const HashSet<T,thash,ALLOC,HASH,EQUALS>::Iterator& rhs) const {
 }
 
-template<class T, int (*thash)(const T& a)>
-T& HashSet<T,thash>::Iterator::operator *() const {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+T& HashSet<T,thash,ALLOC,HASH,EQUALS>::Iterator::operator *() const {
 }
 
-template<class T, int (*thash)(const T& a)>
-T* HashSet<T,thash>::Iterator::operator ->() const {
+template<class T, std::size_t (*thash)(const T& a), template<class> class ALLOC, class HASH, class EQUALS>
+T* HashSet<T,thash,ALLOC,HASH,EQUALS>::Iterator::operator ->() const {
 }
 
 }
@@ -0,0 +1,120 @@
+#ifndef HASH_STATS_HPP_
+#define HASH_STATS_HPP_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <sstream>
+#include <iostream>
+
+
+//Compile with -DICS_HASH_STATS to have HashMap count lookups, probes, and resizes.
+//  Without it those counters (and every statement counting them) are compiled out, so the
+//  table's layout and code are unchanged; stats() still reports the table's shape.
+#ifdef ICS_HASH_STATS
+#include <atomic>
+#include <chrono>
+#define ICS_HASH_STATS_DO(...) __VA_ARGS__
+#else
+#define ICS_HASH_STATS_DO(...)
+#endif
+
+
+namespace ics {
+
+
+//A snapshot of a hash table's health (see HashMap::stats)
+    struct HashStats {
+        //The table's shape, computed by stats() by walking the bins
+        std::size_t size            = 0;
+        std::size_t bins            = 0;    //Including (while resizing) the not yet migrated old bins
+        double      load_factor     = 0;    //size/bins of the current bins
+        std::size_t max_chain       = 0;    //Nodes in the longest bin
+        std::size_t tree_bins       = 0;    //Bins (with long lists) indexed by a tree
+        std::vector<std::size_t> chain_lengths; //chain_lengths[n] = # bins holding n nodes
+        std::size_t bytes_allocated = 0;    //Heap bins and occupancy bitmaps (not a small map's inline one), and nodes (at sizeof each)
+
+        //Counted since construction or reset_stats(); all 0 unless compiled with ICS_HASH_STATS
+        std::size_t lookups         = 0;    //Key searches (by queries, put, and erase)
+        std::size_t probes          = 0;    //Nodes compared during those searches
+        std::size_t max_probes      = 0;    //Most nodes compared by one search
+        std::size_t resizes         = 0;    //Rehashes (growing, shrinking, reserve, ...)
+        double      resize_seconds  = 0;    //Time spent allocating bins and migrating nodes
+
+        double probes_per_lookup () const {return lookups == 0 ? 0 : (double)probes / lookups;}
+        std::string str          () const;
+
+        friend std::ostream& operator << (std::ostream& outs, const HashStats& s) {
+            outs << s.str();
+            return outs;
+        }
+    };
+
+
+#ifdef ICS_HASH_STATS
+//The counters behind a table's HashStats. Lookups may run concurrently (e.g., read-locked
+//  ConcurrentHashMap shards), so they are relaxed atomics. A copied table starts at 0.
+    class HashCounters {
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        HashCounters ()                                     {}
+        HashCounters (const HashCounters&)                  {}
+        HashCounters& operator = (const HashCounters&)      {return *this;}
+
+        void count_lookup (std::size_t compared) {
+            lookups.fetch_add(1, std::memory_order_relaxed);
+            probes.fetch_add(compared, std::memory_order_relaxed);
+            std::size_t most = max_probes.load(std::memory_order_relaxed);
+            while (compared > most && !max_probes.compare_exchange_weak(most, compared, std::memory_order_relaxed))
+                ;
+        }
+        void count_resize ()                       {resizes.fetch_add(1, std::memory_order_relaxed);}
+        void add_resize_time (Clock::time_point start) {
+            resize_nanos.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count(),
+                                   std::memory_order_relaxed);
+        }
+
+        void fill (HashStats& s) const {
+            s.lookups        = lookups.load(std::memory_order_relaxed);
+            s.probes         = probes.load(std::memory_order_relaxed);
+            s.max_probes     = max_probes.load(std::memory_order_relaxed);
+            s.resizes        = resizes.load(std::memory_order_relaxed);
+            s.resize_seconds = resize_nanos.load(std::memory_order_relaxed) / 1e9;
+        }
+        void reset () {
+            lookups = probes = max_probes = resizes = 0;
+            resize_nanos = 0;
+        }
+
+    private:
+        std::atomic<std::size_t>   lookups     {0};
+        std::atomic<std::size_t>   probes      {0};
+        std::atomic<std::size_t>   max_probes  {0};
+        std::atomic<std::size_t>   resizes     {0};
+        std::atomic<std::uint64_t> resize_nanos{0};
+    };
+#endif
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//HashStats definitions
+
+    inline std::string HashStats::str() const {
+        std::ostringstream answer;
+        answer << "HashStats[size=" << size << ",bins=" << bins << ",load_factor=" << load_factor
+               << ",max_chain=" << max_chain << ",tree_bins=" << tree_bins << ",bytes_allocated=" << bytes_allocated << ",chain_lengths=[";
+        for (std::size_t n = 0; n < chain_lengths.size(); ++n)
+            answer << (n == 0 ? "" : ",") << n << ":" << chain_lengths[n];
+        answer << "],lookups=" << lookups << ",probes_per_lookup=" << probes_per_lookup() << ",max_probes=" << max_probes
+               << ",resizes=" << resizes << ",resize_seconds=" << resize_seconds << "]";
+        return answer.str();
+    }
+
+
+}
+
+#endif /* HASH_STATS_HPP_ */
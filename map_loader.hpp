@@ -0,0 +1,152 @@
+#ifndef MAP_LOADER_HPP_
+#define MAP_LOADER_HPP_
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>            //For std::max
+#include <utility>              //For std::move
+#include <cstring>
+#include <fcntl.h>              //POSIX open/mmap: the file is tokenized in place
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ics_exceptions.hpp"
+
+
+namespace ics {
+
+
+//A run of characters inside the mapped file (no copy)
+    struct TextSlice {
+        const char* data;
+        std::size_t length;
+    };
+
+
+//Load every "key;value" line of file_name into m (a map of std::string to std::string, e.g.
+//  DriverMap's), as the driver's "lf" command does: fields after the second are ignored, blank
+//  lines are skipped, a line with no separator raises IcsError, and a later line for the same
+//  key replaces an earlier one. Returns the number of keys added to m (m.size() after minus
+//  before): lines for keys already in m, or repeated in the file, are not counted.
+//The file is mapped and cut into one chunk per thread at line boundaries. Each thread
+//  tokenizes its chunk into TextSlices (no per-line allocation) and then builds its entries'
+//  strings: only that part runs in parallel. The calling thread puts each chunk into m, in
+//  file order, as soon as its thread is done, and then frees the chunk's entries, so later
+//  chunks are parsed while earlier ones are put and the strings of the not yet put chunks
+//  (at most the whole file, if m is slower to fill than the file is to parse) are the only
+//  extra memory. As with "lf", when a line has no separator the chunks before its chunk are
+//  already in m.
+    template<class MAP>
+    std::size_t load_key_value_file (MAP& m, const std::string& file_name, int threads = 0, char separator = ';');
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//load_key_value_file and helper definitions
+
+//Tokenize [begin,end) (whole lines) into key/value slices; returns an error message or ""
+    inline std::string tokenize_key_value_lines (const char* begin, const char* end, char separator, std::vector<TextSlice>& fields) {
+        for (const char* line = begin; line < end;) {
+            const char* eol = static_cast<const char*>(std::memchr(line, '\n', end - line));
+            if (eol == nullptr)
+                eol = end;
+            const char* line_end = eol > line && eol[-1] == '\r' ? eol - 1 : eol;
+            if (line_end > line) {
+                const char* key_end = static_cast<const char*>(std::memchr(line, separator, line_end - line));
+                if (key_end == nullptr)
+                    return "line has no '" + std::string(1,separator) + "': " + std::string(line, line_end - line);
+                const char* value     = key_end + 1;
+                const char* value_end = static_cast<const char*>(std::memchr(value, separator, line_end - value));
+                if (value_end == nullptr)
+                    value_end = line_end;
+                fields.push_back(TextSlice{line, (std::size_t)(key_end - line)});
+                fields.push_back(TextSlice{value, (std::size_t)(value_end - value)});
+            }
+            line = eol + 1;
+        }
+        return "";
+    }
+
+
+    template<class MAP>
+    std::size_t load_key_value_file (MAP& m, const std::string& file_name, int threads, char separator) {
+        typedef typename MAP::Entry Entry;
+
+        int fd = ::open(file_name.c_str(), O_RDONLY);
+        struct stat file_stat;
+        if (fd < 0 || ::fstat(fd, &file_stat) != 0) {
+            if (fd >= 0)
+                ::close(fd);
+            throw FileOpenError("load_key_value_file: cannot open " + file_name);
+        }
+        std::size_t bytes = file_stat.st_size;
+        if (bytes == 0) {
+            ::close(fd);
+            return 0;
+        }
+        void* mapped = ::mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED)
+            throw FileOpenError("load_key_value_file: cannot map " + file_name);
+        const char* file = static_cast<const char*>(mapped);
+        ::madvise(mapped, bytes, MADV_SEQUENTIAL);
+
+        //Chunk boundaries: each (but the first) moved just past the next newline
+        if (threads <= 0)
+            threads = std::thread::hardware_concurrency() == 0 ? 1 : std::thread::hardware_concurrency();
+        std::vector<const char*> bounds(threads + 1, file + bytes);
+        bounds[0] = file;
+        for (int t = 1; t < threads; ++t) {
+            const char* b = std::max(file + bytes * t / threads, bounds[t-1]);
+            const char* eol = b == file + bytes ? nullptr : static_cast<const char*>(std::memchr(b, '\n', file + bytes - b));
+            bounds[t] = eol == nullptr ? file + bytes : eol + 1;
+        }
+
+        std::vector<std::vector<Entry>> entries(threads);
+        std::vector<std::string>        errors (threads);
+        std::vector<std::thread>        workers;
+        for (int t = 0; t < threads; ++t)
+            workers.emplace_back([&,t]{
+                std::vector<TextSlice> fields;
+                errors[t] = tokenize_key_value_lines(bounds[t], bounds[t+1], separator, fields);
+                entries[t].reserve(fields.size() / 2);
+                for (std::size_t i = 0; i < fields.size(); i += 2)
+                    entries[t].push_back(Entry(std::string(fields[i].data,   fields[i].length),
+                                               std::string(fields[i+1].data, fields[i+1].length)));
+            });
+
+        std::size_t before = m.size();
+        std::string error;
+        try {
+            for (int t = 0; t < threads; ++t) {
+                workers[t].join();
+                if (error.empty())
+                    error = errors[t];
+                if (error.empty()) {
+                    m.reserve(m.size() + entries[t].size());
+                    for (Entry& e : entries[t])
+                        m.put(std::move(e.first), std::move(e.second));
+                }
+                std::vector<Entry>().swap(entries[t]);   //Free the chunk's strings now it is in m
+            }
+        } catch (...) {
+            for (std::thread& w : workers)
+                if (w.joinable())
+                    w.join();
+            ::munmap(mapped, bytes);
+            throw;
+        }
+        ::munmap(mapped, bytes);
+        if (!error.empty())
+            throw IcsError("load_key_value_file: " + file_name + ": " + error);
+        return m.size() - before;
+    }
+
+
+}
+
+#endif /* MAP_LOADER_HPP_ */
@@ -0,0 +1,183 @@
+#ifndef NODE_ALLOCATOR_HPP_
+#define NODE_ALLOCATOR_HPP_
+
+#include <new>                  //For placement new
+#include <utility>              //For std::forward
+#include <type_traits>          //For std::aligned_storage
+#include <functional>           //For std::less
+
+
+namespace ics {
+
+
+//Node allocators are the ALLOC template argument of HashMap/HashSet: ALLOC<LN> creates and
+//  destroys the list nodes of one container instance. Each container owns its allocator
+//  (copies start with a fresh one), so allocators need no locking.
+//  create(args...)  constructs a node from args and returns a pointer to it
+//  destroy(n)       destroys and frees one node
+//  release_all()    frees every node ever created, WITHOUT running destructors; only
+//                     legal when bulk_release is true (the container destroys entries first
+//                     when they are not trivially destructible)
+//  shareable        true if any instance may destroy a node another instance created, so
+//                     copies of a container may share its nodes (see HashMap's copy-on-write)
+
+
+//Every node is its own new/delete: the original HashMap/HashSet behavior.
+    template<class N> class HeapNodeAllocator {
+    public:
+        static const bool bulk_release = false;
+        static const bool shareable    = true;
+
+        template<class... Args>
+        N*   create      (Args&&... args) {return new N(std::forward<Args>(args)...);}
+        void destroy     (N* n)           {delete n;}
+        void release_all ()               {}
+    };
+
+
+//The first inline_capacity nodes are slots inside the allocator (so inside the container):
+//  a container of a few entries (e.g., one of many small HashMaps) makes no heap allocation
+//  for them. Beyond that, nodes are new/delete'd as HeapNodeAllocator's. Slots hold about
+//  256 bytes of nodes (between 1 and 8 nodes), which every instance carries.
+    template<class N> class InlineNodeAllocator {
+    public:
+        static const bool bulk_release = false;
+        static const bool shareable    = false;
+        static const int  inline_capacity = sizeof(N) >= 256 ? 1 : 256/sizeof(N) > 8 ? 8 : (int)(256/sizeof(N));
+
+        InlineNodeAllocator  ()                           {}
+        InlineNodeAllocator  (const InlineNodeAllocator&) {}     //Copies do not share slots
+        InlineNodeAllocator& operator = (const InlineNodeAllocator&) {return *this;}
+
+        template<class... Args>
+        N*   create      (Args&&... args);
+        void destroy     (N* n);
+        void release_all ()               {}
+
+    private:
+        typedef typename std::aligned_storage<sizeof(N), alignof(N)>::type Slot;
+        Slot     slots[inline_capacity];
+        unsigned free_slots = (1u << inline_capacity) - 1;  //Bit i is set iff slots[i] is free
+    };
+
+
+//Nodes are carved out of slabs (each twice as large as the last, up to max_slab_nodes) and
+//  recycled through a free list; release_all/the destructor return whole slabs at once.
+    template<class N> class SlabNodeAllocator {
+    public:
+        static const bool bulk_release = true;
+        static const bool shareable    = false;
+
+        SlabNodeAllocator  ()                         {}
+        SlabNodeAllocator  (const SlabNodeAllocator&) {}         //Copies do not share slabs
+        ~SlabNodeAllocator ()                         {release_all();}
+        SlabNodeAllocator& operator = (const SlabNodeAllocator&) {return *this;}
+
+        template<class... Args>
+        N*   create      (Args&&... args);
+        void destroy     (N* n);
+        void release_all ();
+
+    private:
+        static const int min_slab_nodes = 16;
+        static const int max_slab_nodes = 4096;
+
+        struct Slab     {Slab* next; int capacity;};     //Header; the slab's nodes follow it
+        union  FreeNode {FreeNode* next; alignas(N) char storage[sizeof(N)];};
+
+        Slab*     slabs     = nullptr;  //Newest slab first
+        FreeNode* free_list = nullptr;  //Destroyed nodes, reused before carving new ones
+        int       carved    = 0;        //# nodes handed out from slabs->nodes() so far
+
+        //Slab header is padded to whole FreeNodes so the nodes after it stay aligned
+        static const int header_nodes = (sizeof(Slab) + sizeof(FreeNode) - 1) / sizeof(FreeNode);
+        static FreeNode* nodes (Slab* s) {return reinterpret_cast<FreeNode*>(s) + header_nodes;}
+    };
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//InlineNodeAllocator class definitions
+
+    template<class N>
+    template<class... Args>
+    N* InlineNodeAllocator<N>::create (Args&&... args) {
+        if (free_slots == 0)
+            return new N(std::forward<Args>(args)...);
+        int i = 0;
+        while ((free_slots & (1u << i)) == 0)
+            ++i;
+        N* n = new (&slots[i]) N(std::forward<Args>(args)...);
+        free_slots &= ~(1u << i);
+        return n;
+    }
+
+
+    template<class N>
+    void InlineNodeAllocator<N>::destroy (N* n) {
+        const void* p = n;
+        if (std::less<const void*>()(p, slots) || !std::less<const void*>()(p, slots + inline_capacity)) {
+            delete n;
+            return;
+        }
+        n->~N();
+        free_slots |= 1u << (reinterpret_cast<Slot*>(n) - slots);
+    }
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//SlabNodeAllocator class definitions
+
+    template<class N>
+    template<class... Args>
+    N* SlabNodeAllocator<N>::create (Args&&... args) {
+        void* storage;
+        if (free_list != nullptr) {
+            storage   = free_list;
+            free_list = free_list->next;
+        }
+        else {
+            if (slabs == nullptr || carved == slabs->capacity) {
+                int capacity = min_slab_nodes;
+                if (slabs != nullptr)
+                    capacity = slabs->capacity < max_slab_nodes ? 2*slabs->capacity : slabs->capacity;
+                Slab* s = static_cast<Slab*>(::operator new(sizeof(FreeNode) * (header_nodes + capacity)));
+                s->next     = slabs;
+                s->capacity = capacity;
+                slabs       = s;
+                carved      = 0;
+            }
+            storage = &nodes(slabs)[carved++];
+        }
+        return new (storage) N(std::forward<Args>(args)...);
+    }
+
+
+    template<class N>
+    void SlabNodeAllocator<N>::destroy (N* n) {
+        n->~N();
+        FreeNode* f = reinterpret_cast<FreeNode*>(n);
+        f->next   = free_list;
+        free_list = f;
+    }
+
+
+    template<class N>
+    void SlabNodeAllocator<N>::release_all () {
+        while (slabs != nullptr) {
+            Slab* to_delete = slabs;
+            slabs = slabs->next;
+            ::operator delete(to_delete);
+        }
+        free_list = nullptr;
+        carved    = 0;
+    }
+
+
+}
+
+#endif /* NODE_ALLOCATOR_HPP_ */
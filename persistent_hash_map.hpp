@@ -0,0 +1,739 @@
+#ifndef PERSISTENT_HASH_MAP_HPP_
+#define PERSISTENT_HASH_MAP_HPP_
+
+#include <string>
+#include <iostream>
+#include <sstream>
+#include <cstdint>
+#include <atomic>               //For the reference counts of shared nodes
+#include <limits>
+#include <new>                  //For placement new
+#include <initializer_list>
+#include <functional>           //For std::equal_to
+#include "ics_exceptions.hpp"
+#include "pair.hpp"
+#include "hash_functions.hpp"
+
+
+//Number of set bits in a 32-bit word
+#ifndef ICS_POPCOUNT32
+#if defined(__GNUC__) || defined(__clang__)
+#define ICS_POPCOUNT32(w) ((std::size_t)__builtin_popcount(w))
+#else
+#define ICS_POPCOUNT32(w) ics::popcount_by_loop(w)
+#endif
+#endif
+
+
+namespace ics {
+
+
+    inline std::size_t popcount_by_loop (std::uint32_t word) {
+        std::size_t answer = 0;
+        for (; word != 0; word &= word - 1)
+            ++answer;
+        return answer;
+    }
+
+
+//PersistentHashMap is an immutable map: put and erase leave it unchanged and return a new
+//  version, which shares every node the change did not touch with this one (and with any
+//  other versions sharing them). It is a hash array mapped trie: each node indexes its
+//  children by 5 bits of a key's hash (the root by the lowest 5, its children by the next 5,
+//  ...), keeping only the children present, in bit order, found by popcounting the bits below
+//  a key's bit. A put or erase allocates the new nodes on the path to its key (about
+//  log32(size()) of them, plus the entry's) instead of copying the map. Keys whose whole hash
+//  codes collide share a collision node at the bottom, searched linearly.
+//Copying a version is O(1) (a reference count); a version may be read, copied, and destroyed
+//  in any thread, since nodes are never changed once shared and counts are atomic.
+//The hashing template/constructor rules are identical to HashMap's (see hash_map.hpp).
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a) = undefinedhash<KEY>,
+             class HASH = FunctionPointerHash<KEY,thash>, class EQUALS = std::equal_to<KEY>> class PersistentHashMap {
+    public:
+        typedef ics::pair<KEY,T>   Entry;
+        typedef std::size_t (*hashfunc) (const KEY& a);
+
+        //Destructor/Constructors
+        ~PersistentHashMap ();
+
+        PersistentHashMap          (std::size_t (*chash)(const KEY& a) = undefinedhash<KEY>);
+        PersistentHashMap          (const PersistentHashMap<KEY,T,thash,HASH,EQUALS>& to_copy);
+        explicit PersistentHashMap (const std::initializer_list<Entry>& il, std::size_t (*chash)(const KEY& a) = undefinedhash<KEY>);
+
+        //Iterable class must support "for-each" loop: .begin()/.end() and prefix ++ on returned result
+        template <class Iterable>
+        explicit PersistentHashMap (const Iterable& i, std::size_t (*chash)(const KEY& a) = undefinedhash<KEY>);
+
+
+        //Queries
+        bool empty      () const;
+        std::size_t size() const;
+        bool has_key    (const KEY& key) const;
+        bool has_value  (const T& value) const;
+        std::string str () const; //supplies useful debugging information; contrast to operator <<
+
+        //Batch lookups of keys[0..count): values[i] points to keys[i]'s value (nullptr if absent);
+        //  found[i] is has_key(keys[i])
+        void get_many      (const KEY* keys, std::size_t count, const T** values) const;
+        void contains_many (const KEY* keys, std::size_t count, bool* found)      const;
+
+
+        //Commands: each returns the new version (this version is unchanged)
+        PersistentHashMap<KEY,T,thash,HASH,EQUALS> put   (const KEY& key, const T& value) const;
+        PersistentHashMap<KEY,T,thash,HASH,EQUALS> erase (const KEY& key) const;   //KeyError if key is absent
+        PersistentHashMap<KEY,T,thash,HASH,EQUALS> clear () const;
+
+        //Iterable class must support "for-each" loop: .begin()/.end() and prefix ++ on returned result
+        template <class Iterable>
+        PersistentHashMap<KEY,T,thash,HASH,EQUALS> put_all(const Iterable& i) const;
+
+
+        //Operators
+
+        const T& operator [] (const KEY&) const;
+        PersistentHashMap<KEY,T,thash,HASH,EQUALS>& operator = (const PersistentHashMap<KEY,T,thash,HASH,EQUALS>& rhs);
+        bool operator == (const PersistentHashMap<KEY,T,thash,HASH,EQUALS>& rhs) const;
+        bool operator != (const PersistentHashMap<KEY,T,thash,HASH,EQUALS>& rhs) const;
+
+        template<class KEY2,class T2, std::size_t (*hash2)(const KEY2& a), class HASH2, class EQUALS2>
+        friend std::ostream& operator << (std::ostream& outs, const PersistentHashMap<KEY2,T2,hash2,HASH2,EQUALS2>& m);
+
+
+
+    private:
+        struct Counted;
+        struct Leaf;
+        struct Node;
+        static const unsigned bits_per_level = 5;
+        static const unsigned hash_bits      = std::numeric_limits<std::size_t>::digits;
+        static const int      max_depth      = (hash_bits + bits_per_level - 1) / bits_per_level + 1; //With a collision node
+
+    public:
+        class Iterator {
+        public:
+            //Private constructor called in begin/end, which are friends of PersistentHashMap<T>
+            ~Iterator();
+            std::string str  () const;
+            PersistentHashMap<KEY,T,thash,HASH,EQUALS>::Iterator& operator ++ ();
+            PersistentHashMap<KEY,T,thash,HASH,EQUALS>::Iterator  operator ++ (int);
+            bool operator == (const PersistentHashMap<KEY,T,thash,HASH,EQUALS>::Iterator& rhs) const;
+            bool operator != (const PersistentHashMap<KEY,T,thash,HASH,EQUALS>::Iterator& rhs) const;
+            const Entry& operator *  () const;
+            const Entry* operator -> () const;
+            friend std::ostream& operator << (std::ostream& outs, const PersistentHashMap<KEY,T,thash,HASH,EQUALS>::Iterator& i) {
+                outs << i.str(); //Use the same meaning as the debugging .str() method
+                return outs;
+            }
+            friend Iterator PersistentHashMap<KEY,T,thash,HASH,EQUALS>::begin () const;
+            friend Iterator PersistentHashMap<KEY,T,thash,HASH,EQUALS>::end   () const;
+            friend class PersistentHashMap<KEY,T,thash,HASH,EQUALS>;    //operator == reads current's hash_code
+
+        private:
+            struct Level {
+                const Node* node;
+                std::size_t next_slot;
+            };
+            Level       path[max_depth];    //path[0..depth] leads from the root to current's node
+            int         depth   = -1;
+            const Leaf* current = nullptr;  //nullptr at the end
+            const PersistentHashMap<KEY,T,thash,HASH,EQUALS>* ref_map;
+
+            //Helper methods
+            void advance();                 //current = the next leaf (in slot order, depth first)
+
+            //Called in friends begin/end
+            Iterator(const PersistentHashMap<KEY,T,thash,HASH,EQUALS>* iterate_over, bool from_begin);
+        };
+
+
+        Iterator begin () const;
+        Iterator end   () const;
+
+
+    private:
+        //Leaves and nodes are shared by versions: each is deleted when its count drops to 0
+        struct Counted {
+            std::atomic<std::size_t> refs{1};
+        };
+        struct Leaf : Counted {
+            Leaf (std::size_t h, const Entry& v) : hash_code(h), value(v) {}
+
+            std::size_t hash_code;  //hash(value.first), memoized: compared before keys
+            Entry       value;
+        };
+        //count slots follow the node: its leaves (in bit order), then its sub-nodes (in bit order).
+        //  Bit b of data_map/node_map is set iff the leaf/sub-node for hash fragment b is present.
+        //  A collision node has neither map: all count (>= 2) slots are leaves with one hash code.
+        struct Node : Counted {
+            Node (std::uint32_t d, std::uint32_t n, std::uint32_t c) : data_map(d), node_map(n), count(c) {}
+
+            Counted**       slots ()       {return reinterpret_cast<Counted**>(this + 1);}
+            Counted* const* slots () const {return reinterpret_cast<Counted* const*>(this + 1);}
+            Leaf*  leaf    (std::size_t i) const {return static_cast<Leaf*>(slots()[i]);}
+            Node*  child   (std::size_t i) const {return static_cast<Node*>(slots()[i]);}
+            std::size_t leaves () const {return data_map == 0 && node_map == 0 ? count : ICS_POPCOUNT32(data_map);}
+
+            std::uint32_t data_map;
+            std::uint32_t node_map;
+            std::uint32_t count;
+        };
+        static const std::size_t no_slot = std::size_t(-1);
+
+        HASH   hash;                //Hashing policy used (from template or constructor)
+        EQUALS equals;              //Key equality policy used
+        Node*  root = nullptr;      //nullptr iff empty
+        std::size_t used = 0;       //Cache for number of key->value pairs in the trie
+
+
+        //Helper methods
+        PersistentHashMap (const HASH& h, const EQUALS& e, Node* r, std::size_t u); //A version adopting root r
+
+        static std::uint32_t bit_of (std::size_t hash_code, unsigned shift);  //Bit of hash_code's fragment at shift
+        static std::size_t leaf_index (const Node* n, std::uint32_t bit);     //Slot of bit's leaf in n
+        static std::size_t node_index (const Node* n, std::uint32_t bit);     //Slot of bit's sub-node in n
+        static Node* new_node (std::uint32_t data_map, std::uint32_t node_map, std::size_t count); //Slots uninitialized
+        static Node* rebuild  (const Node* n, std::uint32_t data_map, std::uint32_t node_map,
+                               std::size_t remove, std::size_t insert, Counted* inserted); //n's slots but n[remove], with inserted at insert
+        static void  retain   (Counted* c);
+        static void  release  (Leaf* l);
+        static void  release  (Node* n);                                     //And (if deleted) its slots
+        static Node* merge    (Leaf* a, Leaf* b, unsigned shift);            //A node holding both (whose fragments at shift on agree)
+
+        const Leaf* find_leaf (const KEY& key, std::size_t hash_code) const; //Returns key's leaf or nullptr
+        Node* put_in          (const Node* n, Leaf* leaf, unsigned shift, bool& replaced) const; //New n with leaf (n's leaf for its key replaced)
+        Node* remove_from     (const Node* n, const KEY& key, std::size_t hash_code, unsigned shift, bool& found) const; //New n without key (nullptr if empty)
+    };
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//PersistentHashMap class and related definitions
+
+//Destructor/Constructors
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    PersistentHashMap<KEY,T,thash,HASH,EQUALS>::~PersistentHashMap() {
+        if (root != nullptr)
+            release(root);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    PersistentHashMap<KEY,T,thash,HASH,EQUALS>::PersistentHashMap(std::size_t (*chash)(const KEY& k))
+            : hash(hash_policy_traits<HASH>::make(chash)) {
+        hash_policy_traits<HASH>::check(hash, chash, "PersistentHashMap::default constructor");
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    PersistentHashMap<KEY,T,thash,HASH,EQUALS>::PersistentHashMap(const PersistentHashMap<KEY,T,thash,HASH,EQUALS>& to_copy)
+            : hash(to_copy.hash), equals(to_copy.equals), root(to_copy.root), used(to_copy.used) {
+        if (root != nullptr)
+            retain(root);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    PersistentHashMap<KEY,T,thash,HASH,EQUALS>::PersistentHashMap(const std::initializer_list<Entry>& il, std::size_t (*chash)(const KEY& k))
+            : hash(hash_policy_traits<HASH>::make(chash)) {
+        hash_policy_traits<HASH>::check(hash, chash, "PersistentHashMap::initializer_list constructor");
+        *this = put_all(il);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    template <class Iterable>
+    PersistentHashMap<KEY,T,thash,HASH,EQUALS>::PersistentHashMap(const Iterable& i, std::size_t (*chash)(const KEY& k))
+            : hash(hash_policy_traits<HASH>::make(chash)) {
+        hash_policy_traits<HASH>::check(hash, chash, "PersistentHashMap::Iterable constructor");
+        *this = put_all(i);
+    }
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//Queries
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    bool PersistentHashMap<KEY,T,thash,HASH,EQUALS>::empty() const {
+        return used == 0;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    std::size_t PersistentHashMap<KEY,T,thash,HASH,EQUALS>::size() const {
+        return used;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    bool PersistentHashMap<KEY,T,thash,HASH,EQUALS>::has_key (const KEY& key) const {
+        return find_leaf(key, hash(key)) != nullptr;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    bool PersistentHashMap<KEY,T,thash,HASH,EQUALS>::has_value (const T& value) const {
+        for (const Entry& e : *this)
+            if (e.second == value)
+                return true;
+        return false;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    std::string PersistentHashMap<KEY,T,thash,HASH,EQUALS>::str() const {
+        std::ostringstream answer;
+        for (const Entry& e : *this)
+            answer << e.first << "->" << e.second;
+        return answer.str();
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    void PersistentHashMap<KEY,T,thash,HASH,EQUALS>::get_many (const KEY* keys, std::size_t count, const T** values) const {
+        for (std::size_t i = 0; i < count; ++i) {
+            const Leaf* l = find_leaf(keys[i], hash(keys[i]));
+            values[i] = l == nullptr ? nullptr : &l->value.second;
+        }
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    void PersistentHashMap<KEY,T,thash,HASH,EQUALS>::contains_many (const KEY* keys, std::size_t count, bool* found) const {
+        for (std::size_t i = 0; i < count; ++i)
+            found[i] = find_leaf(keys[i], hash(keys[i])) != nullptr;
+    }
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//Commands
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    auto PersistentHashMap<KEY,T,thash,HASH,EQUALS>::put(const KEY& key, const T& value) const -> PersistentHashMap<KEY,T,thash,HASH,EQUALS> {
+        Leaf* leaf = new Leaf(hash(key), Entry(key,value));
+        if (root == nullptr) {
+            Node* r = new_node(bit_of(leaf->hash_code, 0), 0, 1);
+            r->slots()[0] = leaf;
+            return PersistentHashMap<KEY,T,thash,HASH,EQUALS>(hash, equals, r, 1);
+        }
+        bool replaced = false;
+        Node* r = put_in(root, leaf, 0, replaced);
+        return PersistentHashMap<KEY,T,thash,HASH,EQUALS>(hash, equals, r, replaced ? used : used+1);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    auto PersistentHashMap<KEY,T,thash,HASH,EQUALS>::erase(const KEY& key) const -> PersistentHashMap<KEY,T,thash,HASH,EQUALS> {
+        bool found = false;
+        Node* r = root == nullptr ? nullptr : remove_from(root, key, hash(key), 0, found);
+        if (found)
+            return PersistentHashMap<KEY,T,thash,HASH,EQUALS>(hash, equals, r, used-1);
+
+        std::ostringstream answer;
+        answer << "PersistentHashMap::erase: key(" << key << ") not in Map";
+        throw KeyError(answer.str());
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    auto PersistentHashMap<KEY,T,thash,HASH,EQUALS>::clear() const -> PersistentHashMap<KEY,T,thash,HASH,EQUALS> {
+        return PersistentHashMap<KEY,T,thash,HASH,EQUALS>(hash, equals, nullptr, 0);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    template<class Iterable>
+    auto PersistentHashMap<KEY,T,thash,HASH,EQUALS>::put_all(const Iterable& i) const -> PersistentHashMap<KEY,T,thash,HASH,EQUALS> {
+        PersistentHashMap<KEY,T,thash,HASH,EQUALS> answer(*this);
+        for (const Entry& m_entry : i)
+            answer = answer.put(m_entry.first,m_entry.second);
+        return answer;
+    }
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//Operators
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    const T& PersistentHashMap<KEY,T,thash,HASH,EQUALS>::operator [] (const KEY& key) const {
+        const Leaf* l = find_leaf(key, hash(key));
+        if (l != nullptr)
+            return l->value.second;
+
+        std::ostringstream answer;
+        answer << "PersistentHashMap::operator []: key(" << key << ") not in Map";
+        throw KeyError(answer.str());
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    PersistentHashMap<KEY,T,thash,HASH,EQUALS>& PersistentHashMap<KEY,T,thash,HASH,EQUALS>::operator = (const PersistentHashMap<KEY,T,thash,HASH,EQUALS>& rhs) {
+        if (rhs.root != nullptr)
+            retain(rhs.root);       //First: rhs may be (a version sharing) this one's root
+        if (root != nullptr)
+            release(root);
+        hash   = rhs.hash;
+        equals = rhs.equals;
+        root   = rhs.root;
+        used   = rhs.used;
+        return *this;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    bool PersistentHashMap<KEY,T,thash,HASH,EQUALS>::operator == (const PersistentHashMap<KEY,T,thash,HASH,EQUALS>& rhs) const {
+        if (root == rhs.root)       //Including both empty
+            return true;
+        if (used != rhs.used)
+            return false;
+
+        bool same_hash = hash_policy_traits<HASH>::same(hash, rhs.hash);
+        for (Iterator i = begin(); i != end(); ++i) {
+            const Leaf* in_rhs = rhs.find_leaf(i->first, same_hash ? i.current->hash_code : rhs.hash(i->first));
+            if (in_rhs == nullptr || i->second != in_rhs->value.second)
+                return false;
+        }
+        return true;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    bool PersistentHashMap<KEY,T,thash,HASH,EQUALS>::operator != (const PersistentHashMap<KEY,T,thash,HASH,EQUALS>& rhs) const {
+        return !(*this == rhs);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    std::ostream& operator << (std::ostream& outs, const PersistentHashMap<KEY,T,thash,HASH,EQUALS>& m) {
+        outs << "map[";
+        if(!m.empty())
+            outs << m.str();
+        outs << "]";
+        return outs;
+    }
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//Iterator constructors
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    auto PersistentHashMap<KEY,T,thash,HASH,EQUALS>::begin () const -> PersistentHashMap<KEY,T,thash,HASH,EQUALS>::Iterator {
+        return Iterator(this,true);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    auto PersistentHashMap<KEY,T,thash,HASH,EQUALS>::end () const -> PersistentHashMap<KEY,T,thash,HASH,EQUALS>::Iterator {
+        return Iterator(this,false);
+    }
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//Private helper methods
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    PersistentHashMap<KEY,T,thash,HASH,EQUALS>::PersistentHashMap(const HASH& h, const EQUALS& e, Node* r, std::size_t u)
+            : hash(h), equals(e), root(r), used(u) {
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    std::uint32_t PersistentHashMap<KEY,T,thash,HASH,EQUALS>::bit_of (std::size_t hash_code, unsigned shift) {
+        return std::uint32_t(1) << ((hash_code >> shift) & ((1u << bits_per_level) - 1));
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    std::size_t PersistentHashMap<KEY,T,thash,HASH,EQUALS>::leaf_index (const Node* n, std::uint32_t bit) {
+        return ICS_POPCOUNT32(n->data_map & (bit - 1));
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    std::size_t PersistentHashMap<KEY,T,thash,HASH,EQUALS>::node_index (const Node* n, std::uint32_t bit) {
+        return ICS_POPCOUNT32(n->data_map) + ICS_POPCOUNT32(n->node_map & (bit - 1));
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    auto PersistentHashMap<KEY,T,thash,HASH,EQUALS>::new_node (std::uint32_t data_map, std::uint32_t node_map, std::size_t count) -> Node* {
+        void* storage = ::operator new(sizeof(Node) + count * sizeof(Counted*));
+        return new (storage) Node(data_map, node_map, count);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    auto PersistentHashMap<KEY,T,thash,HASH,EQUALS>::rebuild (const Node* n, std::uint32_t data_map, std::uint32_t node_map,
+                                                              std::size_t remove, std::size_t insert, Counted* inserted) -> Node* {
+        std::size_t count = n->count - (remove == no_slot ? 0 : 1) + (insert == no_slot ? 0 : 1);
+        Node* answer = new_node(data_map, node_map, count);
+        Counted* const* from = n->slots();
+        Counted**       to   = answer->slots();
+        for (std::size_t j = 0, k = 0; k < count; ++k) {
+            if (k == insert) {
+                to[k] = inserted;
+                continue;
+            }
+            if (j == remove)
+                ++j;
+            to[k] = from[j++];
+            retain(to[k]);
+        }
+        return answer;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    void PersistentHashMap<KEY,T,thash,HASH,EQUALS>::retain (Counted* c) {
+        c->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    void PersistentHashMap<KEY,T,thash,HASH,EQUALS>::release (Leaf* l) {
+        if (l->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete l;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    void PersistentHashMap<KEY,T,thash,HASH,EQUALS>::release (Node* n) {
+        if (n->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+        std::size_t leaves = n->leaves();
+        for (std::size_t i = 0; i < n->count; ++i)
+            if (i < leaves)
+                release(n->leaf(i));
+            else
+                release(n->child(i));   //At most max_depth deep
+        n->~Node();
+        ::operator delete(n);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    auto PersistentHashMap<KEY,T,thash,HASH,EQUALS>::merge (Leaf* a, Leaf* b, unsigned shift) -> Node* {
+        if (shift >= hash_bits) {
+            Node* answer = new_node(0, 0, 2);
+            answer->slots()[0] = a;
+            answer->slots()[1] = b;
+            return answer;
+        }
+        std::uint32_t bit_a = bit_of(a->hash_code, shift), bit_b = bit_of(b->hash_code, shift);
+        if (bit_a == bit_b) {
+            Node* answer = new_node(0, bit_a, 1);
+            answer->slots()[0] = merge(a, b, shift + bits_per_level);
+            return answer;
+        }
+        Node* answer = new_node(bit_a | bit_b, 0, 2);
+        answer->slots()[0] = bit_a < bit_b ? a : b;
+        answer->slots()[1] = bit_a < bit_b ? b : a;
+        return answer;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    auto PersistentHashMap<KEY,T,thash,HASH,EQUALS>::find_leaf (const KEY& key, std::size_t hash_code) const -> const Leaf* {
+        const Node* n = root;
+        for (unsigned shift = 0; n != nullptr; shift += bits_per_level) {
+            if (shift >= hash_bits) {
+                for (std::size_t i = 0; i < n->count; ++i)
+                    if (n->leaf(i)->hash_code == hash_code && equals(n->leaf(i)->value.first, key))
+                        return n->leaf(i);
+                return nullptr;
+            }
+            std::uint32_t bit = bit_of(hash_code, shift);
+            if (n->data_map & bit) {
+                const Leaf* l = n->leaf(leaf_index(n, bit));
+                return l->hash_code == hash_code && equals(l->value.first, key) ? l : nullptr;
+            }
+            n = n->node_map & bit ? n->child(node_index(n, bit)) : nullptr;
+        }
+        return nullptr;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    auto PersistentHashMap<KEY,T,thash,HASH,EQUALS>::put_in (const Node* n, Leaf* leaf, unsigned shift, bool& replaced) const -> Node* {
+        if (shift >= hash_bits) {
+            for (std::size_t i = 0; i < n->count; ++i)
+                if (equals(n->leaf(i)->value.first, leaf->value.first)) {
+                    replaced = true;
+                    return rebuild(n, 0, 0, i, i, leaf);
+                }
+            return rebuild(n, 0, 0, no_slot, n->count, leaf);
+        }
+
+        std::uint32_t bit = bit_of(leaf->hash_code, shift);
+        if (n->data_map & bit) {
+            std::size_t i   = leaf_index(n, bit);
+            Leaf*       old = n->leaf(i);
+            if (old->hash_code == leaf->hash_code && equals(old->value.first, leaf->value.first)) {
+                replaced = true;
+                return rebuild(n, n->data_map, n->node_map, i, i, leaf);
+            }
+            //Both leaves move one level down, into a new sub-node
+            retain(old);
+            Node* child = merge(old, leaf, shift + bits_per_level);
+            std::uint32_t data_map = n->data_map ^ bit, node_map = n->node_map | bit;
+            return rebuild(n, data_map, node_map, i, ICS_POPCOUNT32(data_map) + ICS_POPCOUNT32(node_map & (bit - 1)), child);
+        }
+        if (n->node_map & bit) {
+            std::size_t i = node_index(n, bit);
+            Node* child = put_in(n->child(i), leaf, shift + bits_per_level, replaced);
+            return rebuild(n, n->data_map, n->node_map, i, i, child);
+        }
+        std::uint32_t data_map = n->data_map | bit;
+        return rebuild(n, data_map, n->node_map, no_slot, ICS_POPCOUNT32(data_map & (bit - 1)), leaf);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    auto PersistentHashMap<KEY,T,thash,HASH,EQUALS>::remove_from (const Node* n, const KEY& key, std::size_t hash_code, unsigned shift, bool& found) const -> Node* {
+        if (shift >= hash_bits) {
+            for (std::size_t i = 0; i < n->count; ++i)
+                if (n->leaf(i)->hash_code == hash_code && equals(n->leaf(i)->value.first, key)) {
+                    found = true;
+                    return rebuild(n, 0, 0, i, no_slot, nullptr);   //Leaves >= 1: the parent inlines 1
+                }
+            return nullptr;
+        }
+
+        std::uint32_t bit = bit_of(hash_code, shift);
+        if (n->data_map & bit) {
+            std::size_t i = leaf_index(n, bit);
+            const Leaf* l = n->leaf(i);
+            if (l->hash_code != hash_code || !equals(l->value.first, key))
+                return nullptr;
+            found = true;
+            return n->count == 1 ? nullptr : rebuild(n, n->data_map ^ bit, n->node_map, i, no_slot, nullptr);
+        }
+        if (n->node_map & bit) {
+            std::size_t i = node_index(n, bit);
+            Node* child = remove_from(n->child(i), key, hash_code, shift + bits_per_level, found);
+            if (!found)
+                return nullptr;
+            if (child->count == 1 && child->leaves() == 1) {
+                //A sub-node left holding one leaf is replaced by that leaf (so sub-nodes never are)
+                Leaf* only = child->leaf(0);
+                retain(only);
+                release(child);
+                std::uint32_t data_map = n->data_map | bit;
+                return rebuild(n, data_map, n->node_map ^ bit, i, ICS_POPCOUNT32(data_map & (bit - 1)), only);
+            }
+            return rebuild(n, n->data_map, n->node_map, i, i, child);
+        }
+        return nullptr;
+    }
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//Iterator class definitions
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    void PersistentHashMap<KEY,T,thash,HASH,EQUALS>::Iterator::advance() {
+        while (depth >= 0) {
+            Level& top = path[depth];
+            if (top.next_slot == top.node->count) {
+                --depth;
+                continue;
+            }
+            std::size_t i = top.next_slot++;
+            if (i < top.node->leaves()) {
+                current = top.node->leaf(i);
+                return;
+            }
+            path[++depth] = Level{top.node->child(i), 0};
+        }
+        current = nullptr;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    PersistentHashMap<KEY,T,thash,HASH,EQUALS>::Iterator::Iterator(const PersistentHashMap<KEY,T,thash,HASH,EQUALS>* iterate_over, bool from_begin)
+            : ref_map(iterate_over) {
+        if (from_begin && ref_map->root != nullptr) {
+            depth   = 0;
+            path[0] = Level{ref_map->root, 0};
+            advance();
+        }
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    PersistentHashMap<KEY,T,thash,HASH,EQUALS>::Iterator::~Iterator()
+    {}
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    std::string PersistentHashMap<KEY,T,thash,HASH,EQUALS>::Iterator::str() const {
+        std::ostringstream answer;
+        answer << ref_map->str() << "(depth=" << depth << ",current=";
+        if (current == nullptr)
+            answer << "end";
+        else
+            answer << current->value.first << "->" << current->value.second;
+        answer << ")";
+        return answer.str();
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    auto PersistentHashMap<KEY,T,thash,HASH,EQUALS>::Iterator::operator ++ () -> PersistentHashMap<KEY,T,thash,HASH,EQUALS>::Iterator& {
+        if (current != nullptr)
+            advance();
+        return *this;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    auto PersistentHashMap<KEY,T,thash,HASH,EQUALS>::Iterator::operator ++ (int) -> PersistentHashMap<KEY,T,thash,HASH,EQUALS>::Iterator {
+        Iterator to_return(*this);
+        if (current != nullptr)
+            advance();
+        return to_return;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    bool PersistentHashMap<KEY,T,thash,HASH,EQUALS>::Iterator::operator == (const PersistentHashMap<KEY,T,thash,HASH,EQUALS>::Iterator& rhs) const {
+        if (ref_map != rhs.ref_map)
+            throw ComparingDifferentIteratorsError("PersistentHashMap::Iterator::operator ==");
+        return current == rhs.current;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    bool PersistentHashMap<KEY,T,thash,HASH,EQUALS>::Iterator::operator != (const PersistentHashMap<KEY,T,thash,HASH,EQUALS>::Iterator& rhs) const {
+        return !(*this == rhs);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    auto PersistentHashMap<KEY,T,thash,HASH,EQUALS>::Iterator::operator *() const -> const Entry& {
+        if (current == nullptr)
+            throw IteratorPositionIllegal("PersistentHashMap::Iterator::operator * Iterator illegal: " + str());
+        return current->value;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    auto PersistentHashMap<KEY,T,thash,HASH,EQUALS>::Iterator::operator ->() const -> const Entry* {
+        if (current == nullptr)
+            throw IteratorPositionIllegal("PersistentHashMap::Iterator::operator -> Iterator illegal: " + str());
+        return &current->value;
+    }
+
+
+}
+
+#endif /* PERSISTENT_HASH_MAP_HPP_ */
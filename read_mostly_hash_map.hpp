@@ -0,0 +1,453 @@
+#ifndef READ_MOSTLY_HASH_MAP_HPP_
+#define READ_MOSTLY_HASH_MAP_HPP_
+
+#include <string>
+#include <sstream>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include "ics_exceptions.hpp"
+#include "pair.hpp"
+#include "hash_functions.hpp"
+
+
+namespace ics {
+
+
+//Epoch-based reclamation: memory unlinked by a writer is freed only once no reader can still
+//  be looking at it. A reader pins itself to the global epoch for the length of a lookup
+//  (writing only its own, padded, per-thread record). The global epoch advances only when
+//  every pinned reader has seen the current one; memory retired in epoch e is freed once the
+//  global epoch reaches e+2, since every reader pinned early enough to see it has unpinned.
+//Readers never block; writers free memory lazily (never waiting for readers).
+    class EpochDomain {
+    public:
+        //Pin the calling thread while alive (nests)
+        class Guard {
+        public:
+            Guard  ();
+            ~Guard ();
+            Guard (const Guard&)             = delete;
+            Guard& operator = (const Guard&) = delete;
+        };
+
+        static EpochDomain& instance ();
+
+        std::uint64_t current_epoch () const {return epoch.load(std::memory_order_seq_cst);}
+        bool          try_advance   ();     //Advance the global epoch if every pinned thread has seen it
+
+    private:
+        struct Record {
+            std::atomic<std::uint64_t> pinned_epoch {0};   //2*epoch+1 while pinned; 0 when not
+            std::atomic<bool>          in_use       {true}; //Owned by a live thread
+            int                        depth        = 0;    //Guard nesting (owning thread only)
+            Record*                    next         = nullptr;
+            char                       padding[64];         //Keep other threads' records off this cache line
+        };
+
+        //Releases the thread's record when the thread exits
+        struct ThreadHandle {
+            Record* record = nullptr;
+            ~ThreadHandle ();
+        };
+
+        std::atomic<std::uint64_t> epoch   {1};
+        std::atomic<Record*>       records {nullptr};  //Append-only; records are reused, never freed
+
+        EpochDomain () {}
+        static Record* local_record ();
+        Record*        acquire_record ();
+    };
+
+
+//A map for read-mostly workloads: lookups (has_key/get/read/operator[]) never lock and never
+//  write to the map; writers (serialized by one mutex) publish changes with atomic pointer
+//  stores and retire the nodes they unlink to EpochDomain. Entries are immutable: put on an
+//  existing key swaps in a new node. Growing copies into a new table that is published in
+//  one store, so readers see either the old or the new table, never a half-moved one.
+//The hashing template/constructor rules are identical to HashMap's (see hash_map.hpp).
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a) = undefinedhash<KEY>,
+             class HASH = FunctionPointerHash<KEY,thash>, class EQUALS = std::equal_to<KEY>> class ReadMostlyHashMap {
+    public:
+        typedef ics::pair<KEY,T> Entry;
+
+        //Destructor/Constructors (no reader may be using the map while it is destroyed)
+        ~ReadMostlyHashMap();
+
+        explicit ReadMostlyHashMap (double the_load_threshold = 1.0, std::size_t (*chash)(const KEY& a) = undefinedhash<KEY>);
+        ReadMostlyHashMap (const ReadMostlyHashMap&)             = delete;
+        ReadMostlyHashMap& operator = (const ReadMostlyHashMap&) = delete;
+
+
+        //Queries: lock-free, safe concurrently with each other and with writers
+        bool        empty   () const;
+        std::size_t size    () const;
+        bool        has_key (const KEY& key) const;
+        bool        get     (const KEY& key, T& value) const;   //Copies key's value into value; false if key is absent
+        template<class F>
+        bool        read    (const KEY& key, F f) const;        //Calls f(const T&) on key's value (no copy); false if absent
+        T           operator [] (const KEY& key) const;         //Copy of key's value; throws KeyError if absent
+
+
+        //Commands: serialized with each other (put/erase return and throw as HashMap's do)
+        T    put   (const KEY& key, const T& value);
+        T    erase (const KEY& key);
+        void clear ();
+
+        std::string str () const; //supplies useful debugging information
+
+
+    private:
+        class LN {
+        public:
+            LN (const Entry& v, std::size_t h, LN* n) : value(v), hash_code(h), next(n) {}
+
+            const Entry       value;      //Never changed once published
+            const std::size_t hash_code;
+            std::atomic<LN*>  next;
+        };
+
+        struct Table {
+            explicit Table (std::size_t b) : bins(b), map(new std::atomic<LN*>[b]) {
+                for (std::size_t i = 0; i < bins; ++i)
+                    map[i].store(nullptr, std::memory_order_relaxed);
+            }
+            ~Table () {delete [] map;}
+
+            const std::size_t  bins;      //A power of 2
+            std::atomic<LN*>*  map;
+        };
+
+        struct Retired {
+            void*         p;
+            void        (*destroy)(void* p);
+            std::uint64_t epoch;
+        };
+
+        HASH                     hash;            //Hashing policy used (from template or constructor)
+        EQUALS                   equals;          //Key equality policy used
+        double                   load_threshold;  //used/bins <= load_threshold
+        std::atomic<Table*>      table;
+        std::atomic<std::size_t> used {0};
+        mutable std::mutex       writer_lock;     //Held by put/erase/clear (and by str, to read retired)
+        std::vector<Retired>     retired;         //Unlinked but maybe still read: guarded by writer_lock
+
+        //Helper methods
+        LN*  find_node (const Table* t, const KEY& key, std::size_t hash_code) const; //Call while pinned
+        void ensure_load_threshold(std::size_t new_used);   //Publish a doubled copy if load_factor > load_threshold
+        template<class P>
+        void retire    (P* p);                              //Free p (alone: a node's next is live) once no reader can reach it
+        void reclaim   ();                                  //Free what no reader can reach any more
+        static void destroy_chain (void* chain);            //delete a whole (unlinked) list of LN
+    };
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//EpochDomain definitions
+
+    inline EpochDomain& EpochDomain::instance() {
+        static EpochDomain domain;
+        return domain;
+    }
+
+
+    inline EpochDomain::Guard::Guard() {
+        Record* r = local_record();
+        if (r->depth++ == 0) {
+            //seq_cst store: a writer that does not see this pin cannot have seen a later epoch's nodes freed
+            r->pinned_epoch.store(2*instance().epoch.load(std::memory_order_relaxed) + 1, std::memory_order_seq_cst);
+            //...and the fence keeps this reader's later (acquire) loads of the table from moving above the pin
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+
+    inline EpochDomain::Guard::~Guard() {
+        Record* r = local_record();
+        if (--r->depth == 0)
+            r->pinned_epoch.store(0, std::memory_order_release);
+    }
+
+
+    inline bool EpochDomain::try_advance() {
+        std::uint64_t e = epoch.load(std::memory_order_seq_cst);
+        for (Record* r = records.load(std::memory_order_acquire); r != nullptr; r = r->next) {
+            std::uint64_t pinned = r->pinned_epoch.load(std::memory_order_seq_cst);
+            if (pinned != 0 && pinned != 2*e + 1)
+                return false;
+        }
+        return epoch.compare_exchange_strong(e, e + 1, std::memory_order_seq_cst);
+    }
+
+
+    inline EpochDomain::ThreadHandle::~ThreadHandle() {
+        if (record != nullptr) {
+            record->pinned_epoch.store(0, std::memory_order_release);
+            record->in_use.store(false, std::memory_order_release);
+        }
+    }
+
+
+    inline EpochDomain::Record* EpochDomain::local_record() {
+        static thread_local ThreadHandle handle;
+        if (handle.record == nullptr)
+            handle.record = instance().acquire_record();
+        return handle.record;
+    }
+
+
+    inline EpochDomain::Record* EpochDomain::acquire_record() {
+        //Reuse the record of a thread that has exited, else push a new one
+        for (Record* r = records.load(std::memory_order_acquire); r != nullptr; r = r->next) {
+            bool free = false;
+            if (!r->in_use.load(std::memory_order_relaxed) && r->in_use.compare_exchange_strong(free, true))
+                return r;
+        }
+        Record* r = new Record();
+        Record* head = records.load(std::memory_order_relaxed);
+        do
+            r->next = head;
+        while (!records.compare_exchange_weak(head, r, std::memory_order_release, std::memory_order_relaxed));
+        return r;
+    }
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//ReadMostlyHashMap class and related definitions
+
+//Destructor/Constructors
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    ReadMostlyHashMap<KEY,T,thash,HASH,EQUALS>::~ReadMostlyHashMap() {
+        Table* t = table.load(std::memory_order_relaxed);
+        for (std::size_t i = 0; i < t->bins; ++i)
+            destroy_chain(t->map[i].load(std::memory_order_relaxed));
+        delete t;
+        for (const Retired& r : retired)
+            r.destroy(r.p);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    ReadMostlyHashMap<KEY,T,thash,HASH,EQUALS>::ReadMostlyHashMap(double the_load_threshold, std::size_t (*chash)(const KEY& k))
+            : hash(hash_policy_traits<HASH>::make(chash)), load_threshold(the_load_threshold), table(new Table(1)) {
+        hash_policy_traits<HASH>::check(hash, chash, "ReadMostlyHashMap::constructor");
+    }
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//Queries
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    bool ReadMostlyHashMap<KEY,T,thash,HASH,EQUALS>::empty() const {
+        return size() == 0;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    std::size_t ReadMostlyHashMap<KEY,T,thash,HASH,EQUALS>::size() const {
+        return used.load(std::memory_order_relaxed);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    bool ReadMostlyHashMap<KEY,T,thash,HASH,EQUALS>::has_key (const KEY& key) const {
+        std::size_t hash_code = hash(key);
+        EpochDomain::Guard pin;
+        return find_node(table.load(std::memory_order_acquire), key, hash_code) != nullptr;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    bool ReadMostlyHashMap<KEY,T,thash,HASH,EQUALS>::get (const KEY& key, T& value) const {
+        return read(key, [&value](const T& v) {value = v;});
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    template<class F>
+    bool ReadMostlyHashMap<KEY,T,thash,HASH,EQUALS>::read (const KEY& key, F f) const {
+        std::size_t hash_code = hash(key);
+        EpochDomain::Guard pin;
+        LN* found = find_node(table.load(std::memory_order_acquire), key, hash_code);
+        if (found == nullptr)
+            return false;
+        f(found->value.second);
+        return true;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    T ReadMostlyHashMap<KEY,T,thash,HASH,EQUALS>::operator [] (const KEY& key) const {
+        T answer;
+        if (!get(key, answer)) {
+            std::ostringstream where;
+            where << "ReadMostlyHashMap::operator []: key(" << key << ") not in Hash";
+            throw KeyError(where.str());
+        }
+        return answer;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    std::string ReadMostlyHashMap<KEY,T,thash,HASH,EQUALS>::str() const {
+        std::ostringstream answer;
+        EpochDomain::Guard pin;
+        std::size_t retired_now;
+        {
+            std::lock_guard<std::mutex> guard(writer_lock);
+            retired_now = retired.size();
+        }
+        Table* t = table.load(std::memory_order_acquire);
+        answer << "read_mostly_hash_map[bins=" << t->bins << ",used=" << size() << ",retired=" << retired_now << "]";
+        for (std::size_t i = 0; i < t->bins; ++i)
+            for (LN* j = t->map[i].load(std::memory_order_acquire); j != nullptr; j = j->next.load(std::memory_order_acquire))
+                answer << j->value.first << "->" << j->value.second;
+        return answer.str();
+    }
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//Commands
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    T ReadMostlyHashMap<KEY,T,thash,HASH,EQUALS>::put(const KEY& key, const T& value) {
+        std::size_t hash_code = hash(key);
+        std::lock_guard<std::mutex> guard(writer_lock);
+        Table* t = table.load(std::memory_order_relaxed);
+        std::atomic<LN*>* link = &t->map[hash_code & (t->bins - 1)];
+        for (LN* j = link->load(std::memory_order_relaxed); j != nullptr; link = &j->next, j = j->next.load(std::memory_order_relaxed))
+            if (j->hash_code == hash_code && equals(j->value.first, key)) {
+                T old_value = j->value.second;
+                link->store(new LN(Entry(key,value), hash_code, j->next.load(std::memory_order_relaxed)), std::memory_order_release);
+                retire(j);
+                reclaim();
+                return old_value;
+            }
+
+        ensure_load_threshold(used.load(std::memory_order_relaxed) + 1);
+        t = table.load(std::memory_order_relaxed);
+        std::atomic<LN*>& head = t->map[hash_code & (t->bins - 1)];
+        head.store(new LN(Entry(key,value), hash_code, head.load(std::memory_order_relaxed)), std::memory_order_release);
+        used.fetch_add(1, std::memory_order_relaxed);
+        reclaim();
+        return value;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    T ReadMostlyHashMap<KEY,T,thash,HASH,EQUALS>::erase(const KEY& key) {
+        std::size_t hash_code = hash(key);
+        std::lock_guard<std::mutex> guard(writer_lock);
+        Table* t = table.load(std::memory_order_relaxed);
+        std::atomic<LN*>* link = &t->map[hash_code & (t->bins - 1)];
+        for (LN* j = link->load(std::memory_order_relaxed); j != nullptr; link = &j->next, j = j->next.load(std::memory_order_relaxed))
+            if (j->hash_code == hash_code && equals(j->value.first, key)) {
+                T to_return = j->value.second;
+                link->store(j->next.load(std::memory_order_relaxed), std::memory_order_release);  //Readers on j still reach j->next
+                used.fetch_sub(1, std::memory_order_relaxed);
+                retire(j);
+                reclaim();
+                return to_return;
+            }
+        std::ostringstream answer;
+        answer << "ReadMostlyHashMap::erase: key(" << key << ") not in Hash";
+        throw KeyError(answer.str());
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    void ReadMostlyHashMap<KEY,T,thash,HASH,EQUALS>::clear() {
+        std::lock_guard<std::mutex> guard(writer_lock);
+        Table* t = table.load(std::memory_order_relaxed);
+        for (std::size_t i = 0; i < t->bins; ++i) {
+            LN* chain = t->map[i].exchange(nullptr, std::memory_order_acq_rel);
+            if (chain != nullptr)
+                retired.push_back(Retired{chain, destroy_chain, EpochDomain::instance().current_epoch()});
+        }
+        used.store(0, std::memory_order_relaxed);
+        reclaim();
+    }
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//Private helper methods
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    typename ReadMostlyHashMap<KEY,T,thash,HASH,EQUALS>::LN* ReadMostlyHashMap<KEY,T,thash,HASH,EQUALS>::find_node (const Table* t, const KEY& key, std::size_t hash_code) const {
+        for (LN* j = t->map[hash_code & (t->bins - 1)].load(std::memory_order_acquire); j != nullptr; j = j->next.load(std::memory_order_acquire))
+            if (j->hash_code == hash_code && equals(j->value.first, key))
+                return j;
+        return nullptr;
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    void ReadMostlyHashMap<KEY,T,thash,HASH,EQUALS>::ensure_load_threshold(std::size_t new_used) {
+        Table* t = table.load(std::memory_order_relaxed);
+        if ((double)new_used / t->bins <= load_threshold)
+            return;
+        //Copy (not relink) nodes: a reader may be walking any old chain
+        Table* grown = new Table(2 * t->bins);
+        for (std::size_t i = 0; i < t->bins; ++i)
+            for (LN* j = t->map[i].load(std::memory_order_relaxed); j != nullptr; j = j->next.load(std::memory_order_relaxed)) {
+                std::atomic<LN*>& head = grown->map[j->hash_code & (grown->bins - 1)];
+                head.store(new LN(j->value, j->hash_code, head.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+            }
+        table.store(grown, std::memory_order_release);
+        for (std::size_t i = 0; i < t->bins; ++i) {
+            LN* chain = t->map[i].load(std::memory_order_relaxed);
+            if (chain != nullptr)
+                retired.push_back(Retired{chain, destroy_chain, EpochDomain::instance().current_epoch()});
+        }
+        retire(t);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    template<class P>
+    void ReadMostlyHashMap<KEY,T,thash,HASH,EQUALS>::retire (P* p) {
+        retired.push_back(Retired{p, [](void* q) {delete static_cast<P*>(q);}, EpochDomain::instance().current_epoch()});
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    void ReadMostlyHashMap<KEY,T,thash,HASH,EQUALS>::reclaim () {
+        EpochDomain& domain = EpochDomain::instance();
+        domain.try_advance();
+        std::uint64_t e = domain.current_epoch();
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i < retired.size(); ++i)
+            if (retired[i].epoch + 2 <= e)
+                retired[i].destroy(retired[i].p);
+            else
+                retired[kept++] = retired[i];
+        retired.resize(kept);
+    }
+
+
+    template<class KEY,class T, std::size_t (*thash)(const KEY& a), class HASH, class EQUALS>
+    void ReadMostlyHashMap<KEY,T,thash,HASH,EQUALS>::destroy_chain (void* chain) {
+        for (LN* j = static_cast<LN*>(chain); j != nullptr;) {
+            LN* to_delete = j;
+            j = j->next.load(std::memory_order_relaxed);
+            delete to_delete;
+        }
+    }
+
+
+}
+
+#endif /* READ_MOSTLY_HASH_MAP_HPP_ */
@@ -2,15 +2,26 @@
 //#include <sstream>
 //#include <algorithm>                 // std::random_shuffle
 //#include "ics46goody.hpp"
+//#include "stopwatch.hpp"
 //#include "gtest/gtest.h"
 //#include "array_priority_queue.hpp"  // must leave in for use in iterator_simple
 //#include "array_queue.hpp"           // must leave in for use in iterator_erase
 //#include "array_stack.hpp"           // must leave in for use in constructor
 //#include "hash_map.hpp"
-//
-//int hash_string  (const std::string& s) {std::hash<std::string> str_hash; return str_hash(s);}
-//int hash_int     (const int& s)         {std::hash<int> str_hash; return str_hash(s);}
-//int hash_string2 (const std::string& s) {std::hash<std::string> str_hash; return 1+str_hash(s);}
+//#include "flat_hash_map.hpp"
+//#include "concurrent_hash_map.hpp"
+//#include "read_mostly_hash_map.hpp"
+//#include "hash_map_snapshot.hpp"
+//#include "map_loader.hpp"
+//#include "persistent_hash_map.hpp"
+//#include <fstream>
+//#include <atomic>
+//#include <thread>
+//#include <mutex>
+//
+//std::size_t hash_string  (const std::string& s) {return ics::string_hash(s);}
+//std::size_t hash_int     (const int& s)         {std::hash<int> str_hash; return str_hash(s);}
+//std::size_t hash_string2 (const std::string& s) {return 1+ics::string_hash(s);}
 //
 //typedef ics::pair<std::string,int>                EntryType;
 //typedef ics::HashMap<std::string,int,hash_string> MapTypeStr;
@@ -100,6 +111,107 @@
 //}
 //
 //
+//TEST_F(MapTest, get_many) {
+//  MapTypeStr m;
+//  m.set_incremental_resize(true,1);   //Some keys are still in the old bins
+//  for (int i=0; i<100; ++i)
+//    m.put(std::to_string(i),i);
+//  std::vector<std::string> keys;
+//  for (int i=0; i<110; ++i)
+//    keys.push_back(std::to_string(i));
+//  std::vector<const int*> values(keys.size());
+//  bool found[110];
+//  m.get_many(keys.data(), keys.size(), values.data());
+//  m.contains_many(keys.data(), keys.size(), found);
+//  for (int i=0; i<110; ++i) {
+//    ASSERT_EQ(m.has_key(keys[i]), found[i]);
+//    if (i < 100)
+//      ASSERT_EQ(i, *values[i]);
+//    else
+//      ASSERT_EQ(nullptr, values[i]);
+//  }
+//  m.get_many(keys.data(), 0, values.data());
+//}
+//
+//
+//TEST_F(MapTest, value_index) {
+//  MapTypeStr m, scanned;
+//  m.set_value_index(true);
+//  for (int i=0; i<test_size; ++i) {
+//    m.put(std::to_string(i),i%10);
+//    scanned.put(std::to_string(i),i%10);
+//  }
+//  ASSERT_TRUE(m.has_value(9));
+//  ASSERT_FALSE(m.has_value(10));
+//  ASSERT_EQ((std::size_t)test_size/10,m.keys_for_value(3).size());
+//  ASSERT_EQ(scanned.keys_for_value(3).size(),m.keys_for_value(3).size());
+//
+//  m.put("3",10);                  //put, erase, operator [], and Iterators all keep it current
+//  m.erase("13");
+//  m["23"] = 11;
+//  ASSERT_TRUE(m.has_value(10));
+//  ASSERT_TRUE(m.has_value(11));
+//  ASSERT_EQ((std::size_t)test_size/10-3,m.keys_for_value(3).size());
+//  for (MapTypeStr::Iterator i = m.begin(); i != m.end(); ++i)
+//    if (i->second == 9)
+//      i->second = 12;
+//  ASSERT_FALSE(m.has_value(9));
+//  ASSERT_EQ((std::size_t)test_size/10,m.keys_for_value(12).size());
+//  MapTypeStr c(m);
+//  c.erase("23");
+//  ASSERT_FALSE(c.has_value(11));
+//  ASSERT_TRUE(m.has_value(11));
+//  ASSERT_EQ(std::vector<std::string>{"23"},m.keys_for_value(11));
+//  m.clear();
+//  ASSERT_FALSE(m.has_value(12));
+//
+//  //A T& or Iterator may be written through after a query: later queries see that
+//  for (int i=0; i<100; ++i)
+//    m.put(std::to_string(i),i);
+//  int& r = m["5"];
+//  ASSERT_TRUE(m.has_value(0));
+//  r = 12345;
+//  ASSERT_TRUE(m.has_value(12345));
+//  ASSERT_FALSE(m.has_value(5));
+//  ASSERT_EQ(std::vector<std::string>{"5"},m.keys_for_value(12345));
+//  int wrote = 0;
+//  for (auto& e : m)
+//    if (!m.has_value(-1)) {
+//      e.second = -1;
+//      ++wrote;
+//    }
+//  ASSERT_EQ(1,wrote);
+//  m.put("100",100);               //Ends the Iterator's writes (not r's): the index is rebuilt
+//  ASSERT_EQ(1u,m.keys_for_value(-1).size());
+//  ASSERT_TRUE(m.has_value(12345) || m.keys_for_value(-1)[0] == "5");
+//  m.erase("7");
+//  m.put("101",101);
+//  ASSERT_TRUE(m.has_value(0));
+//  r = 12346;                      //Still seen, however many commands later
+//  ASSERT_TRUE(m.has_value(12346));
+//  ASSERT_FALSE(m.has_value(12345));
+//  ASSERT_EQ(std::vector<std::string>{"5"},m.keys_for_value(12346));
+//  m.set_value_index(false);       //Indexing again after a T& was returned
+//  m.set_value_index(true);
+//  r = 12347;
+//  ASSERT_TRUE(m.has_value(12347));
+//  ASSERT_FALSE(m.has_value(12346));
+//
+//  const int queries = 1000;
+//  ics::Stopwatch indexed, scan;
+//  indexed.start();
+//  for (int q=0; q<queries; ++q)
+//    ASSERT_FALSE(c.has_value(-1));
+//  indexed.stop();
+//  scan.start();
+//  for (int q=0; q<queries; ++q)
+//    ASSERT_FALSE(scanned.has_value(-1));
+//  scan.stop();
+//  std::cout << "  " << test_size << " entries: has_value " << indexed.read()/queries*1e9 << " ns indexed, "
+//            << scan.read()/queries*1e9 << " ns scanning" << std::endl;
+//}
+//
+//
 //TEST_F(MapTest, put) {
 //  MapTypeStr m;
 //  ASSERT_FALSE(m.has_key("x"));
@@ -386,6 +498,135 @@
 //}
 //
 //
+//TEST_F(MapTest, reserve_shrink_to_fit) {
+//  MapTypeInt m;
+//  m.reserve(1000);
+//  auto i = m.begin();
+//  for (int k=0; k<1000; ++k)     //No rehash, so no concurrent modification either
+//    m.put(k,k);
+//  ASSERT_EQ(m.end(), i);
+//  m.reserve(10);
+//  for (int k=10; k<1000; ++k)
+//    m.erase(k);
+//  m.shrink_to_fit();
+//  ASSERT_EQ(10, m.size());
+//  for (int k=0; k<10; ++k)
+//    ASSERT_EQ(k, m[k]);
+//  m.put(10,10);
+//  ASSERT_EQ(10, m[10]);
+//
+//  //Erasing does not shrink (by default), so it never undoes a reserve
+//  MapTypeInt reserved;
+//  reserved.reserve(1000000);
+//  std::size_t bins = reserved.stats().bins;
+//  reserved.put(1,1);
+//  reserved.put(2,2);
+//  reserved.erase(1);
+//  ASSERT_EQ(bins, reserved.stats().bins);
+//
+//  std::vector<ics::pair<int,int>> entries;
+//  for (int k=0; k<1000; ++k)
+//    entries.push_back(ics::pair<int,int>(k,-k));
+//  MapTypeInt from_vector(entries);   //Sized from entries.size()
+//  ASSERT_EQ(1000, from_vector.size());
+//  for (int k=0; k<1000; ++k)
+//    ASSERT_EQ(-k, from_vector[k]);
+//}
+//
+//
+//TEST_F(MapTest, snapshot) {
+//  ics::HashMap<std::string,std::string,hash_string> m;
+//  for (int k=0; k<1000; ++k)
+//    m.put("k"+std::to_string(k), std::string(k%7,'v'));
+//  ics::write_snapshot(m, "test_map.snapshot");
+//  ics::MappedHashMap<std::string,std::string,hash_string> mm("test_map.snapshot");
+//  ASSERT_EQ(m.size(), mm.size());
+//  for (auto kv : m)
+//    ASSERT_EQ(kv.second, mm[kv.first].str());
+//  ASSERT_FALSE(mm.has_key("k1000"));
+//  ASSERT_THROW(mm["k1000"],ics::KeyError);
+//
+//  MapTypeInt mi;
+//  mi.set_hash_mixing(true);
+//  for (int k=0; k<1000; ++k)
+//    mi.put(8*k,k);
+//  ics::write_snapshot(mi, "test_map.snapshot");    //Replaces the file: mm still maps the old one
+//  ics::MappedHashMap<int,int,hash_int> mmi("test_map.snapshot");
+//  for (int k=0; k<1000; ++k)
+//    ASSERT_EQ(k, mmi[8*k]);
+//  ASSERT_EQ("", mm["k0"].str());
+//  ASSERT_THROW((ics::MappedHashMap<int,std::string,hash_int>("test_map.snapshot")),ics::IcsError);
+//
+//  //Corrupt offsets are rejected when the file is opened, not followed by lookups
+//  typedef ics::MappedHashMap<std::string,std::string,hash_string> MappedStr;
+//  auto corrupt = [&m] (std::size_t at, std::uint64_t bad) {
+//    ics::write_snapshot(m, "test_map.snapshot");
+//    std::fstream f("test_map.snapshot", std::ios::in | std::ios::out | std::ios::binary);
+//    ics::SnapshotHeader h;
+//    f.read(reinterpret_cast<char*>(&h), sizeof(h));
+//    f.seekp(sizeof(h) + (at == 0 ? 8 : (h.bins+1)*8 + at));   //bin_start[1], or into entry 0
+//    f.write(reinterpret_cast<const char*>(&bad), sizeof(bad));
+//  };
+//  corrupt(0, m.size()+1);                    //bin_start[1] beyond used
+//  ASSERT_THROW(MappedStr("test_map.snapshot"),ics::IcsError);
+//  corrupt(8, ~std::uint64_t(0));             //Key's string offset beyond the file
+//  ASSERT_THROW(MappedStr("test_map.snapshot"),ics::IcsError);
+//  corrupt(16, 1ULL << 40);                   //Key's string length beyond the file
+//  ASSERT_THROW(MappedStr("test_map.snapshot"),ics::IcsError);
+//  std::ofstream("test_map.snapshot", std::ios::app) << 'x';   //One byte too long
+//  ASSERT_THROW(MappedStr("test_map.snapshot"),ics::IcsError);
+//  std::remove("test_map.snapshot");
+//
+//  //A failed write leaves no .tmp file behind
+//  ::mkdir("test_map.dir", 0755);
+//  ASSERT_THROW(ics::write_snapshot(m, "test_map.dir"),ics::FileOpenError);
+//  ASSERT_FALSE((bool)std::ifstream("test_map.dir.tmp"));
+//  ::rmdir("test_map.dir");
+//}
+//
+//
+////Loads the same key;value file as the driver's "lf" (getline/split/put) and "lp" commands,
+////  reporting each one's throughput
+//TEST_F(MapTest, load_key_value_file_speed) {
+//  typedef ics::HashMap<std::string,std::string,hash_string> MapTypeStrStr;
+//  {
+//    std::ofstream out("test_map_load.txt");
+//    for (int i=0; i<speed_size; ++i)
+//      out << "key" << ics::rand_range(0,speed_size) << ";value" << i << "\n";
+//  }
+//  double megabytes;
+//  {
+//    std::ifstream in("test_map_load.txt", std::ios::ate);
+//    megabytes = in.tellg()/1e6;
+//  }
+//
+//  MapTypeStrStr by_line, by_chunk;
+//  ics::Stopwatch sw;
+//  sw.start();
+//  std::ifstream in("test_map_load.txt");
+//  std::string line;
+//  while (getline(in,line)) {
+//    std::vector<std::string> line_2 = ics::split(line,";");
+//    by_line.put(line_2[0],line_2[1]);
+//  }
+//  sw.stop();
+//  double line_secs = sw.read();
+//
+//  ics::Stopwatch sw_chunk;
+//  sw_chunk.start();
+//  ASSERT_EQ(by_line.size(), ics::load_key_value_file(by_chunk, "test_map_load.txt"));
+//  sw_chunk.stop();
+//  ASSERT_EQ(by_line, by_chunk);
+//  ASSERT_EQ(0u, ics::load_key_value_file(by_chunk, "test_map_load.txt", 3));   //Every key already there
+//  ASSERT_EQ(by_line, by_chunk);
+//  std::cout << "  " << megabytes << " MB: getline/split " << megabytes/line_secs << " MB/s, load_key_value_file "
+//            << megabytes/sw_chunk.read() << " MB/s" << std::endl;
+//  std::ofstream("test_map_load.txt") << "a;1\nno separator\nb;2\n";
+//  ASSERT_THROW(ics::load_key_value_file(by_chunk, "test_map_load.txt", 2),ics::IcsError);
+//  std::remove("test_map_load.txt");
+//}
+//
+//
 //TEST_F(MapTest, clear) {
 //  MapTypeStr m;
 //  m.clear();
@@ -550,6 +791,84 @@
 //}
 //
 //
+////Copies share one table until each is first changed
+//TEST_F(MapTest, copy_on_write) {
+//  MapTypeStr m;
+//  for (int i=0; i<test_size; ++i)
+//    m.put(std::to_string(i),i);
+//  const MapTypeStr& cm = m;
+//  MapTypeStr c(m), a;
+//  a = m;
+//  ASSERT_EQ(m,c);
+//  ASSERT_EQ(m,a);
+//
+//  c.put("0",-1);
+//  a.erase("1");
+//  ASSERT_EQ(0,cm["0"]);
+//  ASSERT_EQ(-1,c["0"]);
+//  ASSERT_TRUE(m.has_key("1"));
+//  ASSERT_FALSE(a.has_key("1"));
+//  ASSERT_EQ(test_size,m.size());
+//
+//  MapTypeStr b(m);
+//  for (MapTypeStr::Iterator i = b.begin(); i != b.end(); ++i)
+//    i->second = -1;
+//  ASSERT_EQ(1,cm["1"]);
+//  MapTypeStr e(m);
+//  int sum = 0;
+//  for (auto& kv : static_cast<const MapTypeStr&>(e))  //ConstIterator: kv.second = -1 would not compile
+//    sum += kv.second;
+//  ASSERT_EQ(test_size*(test_size-1)/2,sum);
+//  for (MapTypeStr::Iterator i = e.begin(); i != e.end(); ++i)
+//    if (i->second % 2 == 0)
+//      i.erase();
+//  ASSERT_EQ(test_size/2,e.size());
+//  ASSERT_EQ(test_size,m.size());
+//  b.clear();
+//  ASSERT_EQ(m,c = m);
+//
+//  //A T& or Iterator handed out before a copy must not write into the copy
+//  MapTypeStr w(m);
+//  int& r = w["5"];
+//  MapTypeStr by_ref(w), by_assign;
+//  by_assign = w;
+//  r = 999;
+//  ASSERT_EQ(5,by_ref["5"]);
+//  ASSERT_EQ(5,by_assign["5"]);
+//  ASSERT_EQ(999,w["5"]);
+//  MapTypeStr::Iterator i = w.begin();
+//  MapTypeStr by_iter(w);
+//  std::string first = i->first;
+//  int was = i->second;
+//  i->second = -999;
+//  ASSERT_EQ(was,by_iter[first]);
+//  ASSERT_EQ(-999,w[first]);
+//  ASSERT_EQ(5,cm["5"]);
+//  MapTypeStr x(m);                    //An Iterator that erased may still write
+//  MapTypeStr::Iterator xi = x.begin();
+//  xi.erase();
+//  ++xi;
+//  MapTypeStr by_erased(x);
+//  first = xi->first;
+//  was = xi->second;
+//  xi->second = -7;
+//  ASSERT_EQ(was,by_erased[first]);
+//  ASSERT_EQ(-7,x[first]);
+//  x.put("x",0);                       //Invalidates xi: copies of x may share again
+//  ASSERT_THROW(*xi,ics::ConcurrentModificationError);
+//
+//  const int copies = 1000;
+//  ics::Stopwatch watch;
+//  watch.start();
+//  for (int n=0; n<copies; ++n) {
+//    MapTypeStr s(m);
+//    ASSERT_EQ(test_size,s.size());
+//  }
+//  watch.stop();
+//  std::cout << "  " << test_size << " entries: " << watch.read()/copies*1e6 << " us per copy" << std::endl;
+//}
+//
+//
 //TEST_F(MapTest, iterator_plusplus) {
 //  MapTypeStr m,m_iter;
 //  load(m,"fcijbdegah", new int[10]{6,3,9,10,2,4,5,7,1,8});
@@ -701,6 +1020,453 @@
 //}
 //
 //
+//TEST_F(MapTest, iterator_sparse) {
+//  MapTypeInt m;
+//  m.set_incremental_resize(true,1);    //Also iterates over the not yet migrated old bins
+//  m.set_shrink_threshold(0);           //Keep every bin: this tests sparse scans
+//  for (int i=0; i<100000; ++i)
+//    m.put(i,i);
+//  for (int i=0; i<100000; ++i)
+//    if (i%1000 != 999)
+//      m.erase(i);
+//  ASSERT_EQ(100, m.size());
+//  int count = 0;
+//  for (auto kv : m) {
+//    ASSERT_EQ(999, kv.first%1000);
+//    ++count;
+//  }
+//  ASSERT_EQ(100, count);
+//  for (auto i = m.begin(); i != m.end(); ++i)
+//    if (i->first%2000 == 999)
+//      i.erase();
+//  ASSERT_EQ(50, m.size());
+//  ASSERT_FALSE(m.has_value(999));
+//  ASSERT_TRUE(m.has_value(1999));
+//
+//  //Scans skip 64 empty bins at a time: str() of 50 entries in ~128K bins is fast
+//  ics::Stopwatch sw;
+//  sw.start();
+//  for (int i=0; i<1000; ++i)
+//    m.str();
+//  sw.stop();
+//  ASSERT_LT(sw.read(), 1.0);
+//}
+//
+//
+//TEST_F(MapTest, string_hash) {
+//  ASSERT_EQ(0xC5BAC3DB178713C4ULL, ics::hash_bytes("a",1,1));   //wyhash's test vectors
+//  ASSERT_EQ(0x6CC5EAB49A92D617ULL, ics::hash_bytes("12345678901234567890123456789012345678901234567890123456789012345678901234567890",80,6));
+//  ASSERT_NE(ics::hash_combine(ics::hash_combine(0,1),2), ics::hash_combine(ics::hash_combine(0,2),1));
+//
+//  typedef ics::pair<std::string,int> PairKey;
+//  ics::PolicyHashMap<PairKey,int> by_pair;    //Hashed by ics::hash<PairKey>: hash_combine
+//  for (int i=0; i<1000; ++i)
+//    by_pair[PairKey(std::to_string(i%10),i)] = i;
+//  ASSERT_EQ(1000, by_pair.size());
+//  ASSERT_EQ(37, by_pair[PairKey("7",37)]);
+//  ics::HashMap<int,int,ics::integer_hash<int>> mixed;
+//  for (int i=0; i<1024; ++i)
+//    mixed[i<<10] = i;              //Identity hashes would put these all in bin 0
+//  ASSERT_LE(mixed.stats().max_chain, 8);
+//
+//  //On wghuck.txt's tokens: faster than std::hash, and spread as evenly
+//  std::ifstream in("wghuck.txt");
+//  ASSERT_TRUE((bool)in);
+//  std::vector<std::string> tokens;
+//  for (std::string t; in >> t;)
+//    tokens.push_back(t);
+//  std::size_t sum = 0;
+//  ics::Stopwatch by_std, by_ics;
+//  by_std.start();
+//  for (int rep=0; rep<20; ++rep)
+//    for (const std::string& t : tokens)
+//      sum += std::hash<std::string>()(t);
+//  by_std.stop();
+//  by_ics.start();
+//  for (int rep=0; rep<20; ++rep)
+//    for (const std::string& t : tokens)
+//      sum += ics::string_hash(t);
+//  by_ics.stop();
+//  std::cout << "  std::hash " << by_std.read() << "s, ics::string_hash " << by_ics.read() << "s (" << sum%2 << ")" << std::endl;
+//  ASSERT_LT(by_ics.read(), by_std.read());
+//  MapTypeStr words;
+//  for (const std::string& t : tokens)
+//    words[t] += 1;
+//  ics::HashStats s = words.stats();
+//  std::cout << "  " << s << std::endl;
+//  ASSERT_LE(s.max_chain, 10);
+//}
+//
+//
+//struct HashIntFunctor {std::size_t operator () (const int& i) const {return hash_int(i);}};
+//
+//template<class M>
+//double time_int_map (M& m) {
+//  ics::Stopwatch sw;
+//  sw.start();
+//  for (int i=0; i<speed_size; ++i)
+//    m.put(i,i);
+//  int found = 0;
+//  for (int rep=0; rep<5; ++rep)
+//    for (int i=0; i<2*speed_size; ++i)
+//      found += m.has_key(i);
+//  sw.stop();
+//  EXPECT_EQ(5*speed_size, found);
+//  return sw.read();
+//}
+//
+//TEST_F(MapTest, hash_policy_speed) {
+//  //The same hash three ways: a constructor argument is called through a stored pointer;
+//  //  a template argument or a policy functor is known at compile time and inlined
+//  ics::HashMap<int,int>                      by_pointer(1.0,hash_int);
+//  MapTypeInt                                 by_template;
+//  ics::PolicyHashMap<int,int,HashIntFunctor> by_functor;
+//  double pointer = time_int_map(by_pointer);
+//  double templ   = time_int_map(by_template);
+//  double functor = time_int_map(by_functor);
+//  std::cout << "  constructor pointer " << pointer << "s, template pointer " << templ
+//            << "s, policy functor " << functor << "s" << std::endl;
+//}
+//
+//
+//std::size_t hash_constant (const std::string&) {return 42;}
+//
+//TEST_F(MapTest, collision_trees) {
+//  //Every key collides: the one bin is searched through its tree
+//  ics::HashMap<std::string,int,hash_constant> m;
+//  ics::Stopwatch sw;
+//  sw.start();
+//  for (int i=0; i<20000; ++i)
+//    m.put("user"+std::to_string(i), i);
+//  for (int i=0; i<20000; ++i)
+//    ASSERT_EQ(i, m["user"+std::to_string(i)]);
+//  sw.stop();
+//  std::cout << "  20000 colliding keys put/looked up in " << sw.read() << "s" << std::endl;
+//  ASSERT_LT(sw.read(), 0.5);      //Chains alone take seconds
+//  ASSERT_EQ(1, m.stats().tree_bins);
+//
+//  ics::HashMap<std::string,int,hash_constant> copy(m);
+//  ASSERT_EQ(m, copy);
+//  for (auto i = m.begin(); i != m.end(); ++i)
+//    if (i->second%100 != 0)
+//      i.erase();
+//  ASSERT_EQ(200, m.size());
+//  for (int i=0; i<20000; ++i)
+//    ASSERT_EQ(i%100 == 0, m.has_key("user"+std::to_string(i)));
+//  for (int i=0; i<20000; i+=100)
+//    m.erase("user"+std::to_string(i));
+//  ASSERT_EQ(0, m.stats().tree_bins);   //Dropped once its list was short
+//  ASSERT_TRUE(copy.has_key("user19999"));
+//
+//  //Seeded tables hash the same key differently; a copy keeps its original's seed
+//  ics::PolicyHashMap<std::string,int,ics::SeededHash<std::string>> s1, s2;
+//  ASSERT_NE(ics::SeededHash<std::string>()("user"), ics::SeededHash<std::string>()("user"));
+//  for (int i=0; i<1000; ++i)
+//    s1.put("user"+std::to_string(i), i);
+//  s2 = s1;
+//  ASSERT_EQ(s1, s2);
+//  ics::PolicyHashMap<std::string,int,ics::SeededHash<std::string>> s3(s1);
+//  ASSERT_EQ(s1, s3);
+//  ASSERT_EQ(0, s3.stats().tree_bins);
+//}
+//
+//
+//TEST_F(MapTest, persistent_hash_map) {
+//  typedef ics::PersistentHashMap<std::string,int,hash_string> PMapTypeStr;
+//  std::vector<PMapTypeStr> versions(1);
+//  for (int i=0; i<test_size; ++i)
+//    versions.push_back(versions.back().put(std::to_string(i),i));
+//  for (int v=0; v<=test_size; ++v) {
+//    ASSERT_EQ(v,versions[v].size());
+//    ASSERT_EQ(v > 0, versions[v].has_key("0"));
+//    ASSERT_EQ(v == test_size, versions[v].has_key(std::to_string(test_size-1)));
+//  }
+//  PMapTypeStr all = versions.back();
+//  PMapTypeStr changed = all.put("0",-1);
+//  ASSERT_EQ(0,all["0"]);
+//  ASSERT_EQ(-1,changed["0"]);
+//  ASSERT_EQ(all.size(),changed.size());
+//  ASSERT_NE(all,changed);
+//  ASSERT_EQ(all,changed.put("0",0));
+//  PMapTypeStr fewer = all.erase("1");
+//  ASSERT_TRUE(all.has_key("1"));
+//  ASSERT_FALSE(fewer.has_key("1"));
+//  ASSERT_THROW(fewer.erase("1"),ics::KeyError);
+//  ASSERT_THROW(fewer["1"],ics::KeyError);
+//  ASSERT_TRUE(all.clear().empty());
+//
+//  int count = 0;
+//  for (const auto& kv : all) {
+//    ASSERT_EQ(std::to_string(kv.second),kv.first);
+//    ++count;
+//  }
+//  ASSERT_EQ(test_size,count);
+//  MapTypeStr m;
+//  m.put_all(all);
+//  ASSERT_EQ(all,PMapTypeStr(m));
+//
+//  //Keys whose hash codes all collide share a collision node
+//  ics::PersistentHashMap<std::string,int,hash_constant> c;
+//  for (int i=0; i<200; ++i)
+//    c = c.put("user"+std::to_string(i), i);
+//  ics::PersistentHashMap<std::string,int,hash_constant> c2 = c.erase("user7");
+//  for (int i=0; i<200; ++i) {
+//    ASSERT_EQ(i, c["user"+std::to_string(i)]);
+//    ASSERT_EQ(i != 7, c2.has_key("user"+std::to_string(i)));
+//  }
+//
+//  //A version costs the nodes on its key's path; a HashMap version costs a full copy
+//  const int puts = 1000;
+//  ics::Stopwatch p_watch, m_watch;
+//  p_watch.start();
+//  for (int n=0; n<puts; ++n)
+//    changed = all.put("new",n);
+//  p_watch.stop();
+//  m_watch.start();
+//  for (int n=0; n<puts/10; ++n) {
+//    MapTypeStr copy(m);
+//    copy.put("new",n);
+//  }
+//  m_watch.stop();
+//  std::cout << "  " << test_size << " entries: " << p_watch.read()/puts*1e6 << " us per PersistentHashMap version, "
+//            << m_watch.read()/(puts/10)*1e6 << " us per HashMap copy+put" << std::endl;
+//}
+//
+//
+//TEST_F(MapTest, stats) {
+//  MapTypeInt m;
+//  for (int i=0; i<1000; ++i)
+//    m.put(i,i);
+//  ics::HashStats s = m.stats();
+//  ASSERT_EQ(1000, s.size);
+//  ASSERT_EQ(1024, s.bins);
+//  ASSERT_DOUBLE_EQ(1000.0/1024, s.load_factor);
+//  std::size_t bins = 0, nodes = 0;
+//  for (std::size_t n=0; n<s.chain_lengths.size(); ++n) {
+//    bins  += s.chain_lengths[n];
+//    nodes += n*s.chain_lengths[n];
+//  }
+//  ASSERT_EQ(s.bins, bins);
+//  ASSERT_EQ(1000, nodes);
+//  ASSERT_EQ(s.chain_lengths.size()-1, s.max_chain);
+//  ASSERT_GT(s.bytes_allocated, 1024*sizeof(void*));
+//
+//#ifdef ICS_HASH_STATS
+//  m.reset_stats();
+//  for (int i=0; i<2000; ++i)
+//    m.has_key(i);
+//  s = m.stats();
+//  ASSERT_EQ(2000, s.lookups);
+//  ASSERT_LE(s.max_probes, s.max_chain);
+//  ASSERT_LE(s.probes, 2000*s.max_probes);
+//  m.reserve(100000);
+//  m.shrink_to_fit();
+//  ASSERT_EQ(2, m.stats().resizes);
+//#else
+//  ASSERT_EQ(0, s.lookups);
+//  ASSERT_EQ(0, s.resizes);
+//#endif
+//}
+//
+//
+//TEST_F(MapTest, shrink_threshold) {
+//  MapTypeInt m;
+//  ASSERT_THROW(m.set_shrink_threshold(-0.1),ics::IcsError);
+//  ASSERT_THROW(m.set_shrink_threshold(0.5),ics::IcsError);    //Above load_threshold/4
+//  m.set_shrink_threshold(0.25);
+//  for (int i=0; i<100000; ++i)
+//    m.put(i,i);
+//  for (int i=0; i<100000; ++i)
+//    if (i%100 != 0) {
+//      ASSERT_EQ(i, m.erase(i));
+//    }
+//  ASSERT_EQ(1000, m.size());
+//  for (int i=0; i<100000; ++i)
+//    ASSERT_EQ(i%100 == 0, m.has_key(i));
+//
+//  //Iterator::erase shrinks only at the end: the loop never sees a ConcurrentModificationError
+//  for (int i=0; i<100000; ++i)
+//    m.put(i,i);
+//  auto i = m.begin();
+//  for (; i != m.end(); ++i)
+//    if (i->first%1000 != 0)
+//      i.erase();
+//  ASSERT_TRUE(i == m.end());
+//  ASSERT_EQ(100, m.size());
+//  int count = 0;
+//  for (auto kv : m) {
+//    ASSERT_EQ(0, kv.first%1000);
+//    ++count;
+//  }
+//  ASSERT_EQ(100, count);
+//
+//  //Shrinking then growing back keeps every entry
+//  for (int round=0; round<10; ++round) {
+//    for (int i=0; i<10000; ++i)
+//      m[i] = i;
+//    for (int i=0; i<10000; ++i)
+//      if (i%1000 != 0)
+//        m.erase(i);
+//  }
+//  ASSERT_EQ(100, m.size());
+//  ASSERT_TRUE(m.has_key(99000));
+//}
+//
+//
+//std::size_t hash_calls   = 0;
+//std::size_t equals_calls = 0;
+//struct CountingHash   {std::size_t operator () (const std::string& s) const {++hash_calls; return ics::string_hash(s);}};
+//struct CountingEquals {bool operator () (const std::string& a, const std::string& b) const {++equals_calls; return a == b;}};
+//
+//TEST_F(MapTest, memoized_hash) {
+//  ics::PolicyHashMap<std::string,int,CountingHash,CountingEquals> m;
+//  std::vector<std::string> keys;
+//  for (int i=0; i<test_size; ++i)
+//    keys.push_back("key" + std::to_string(i));
+//
+//  //Each put hashes its key once; the many resizes along the way hash nothing
+//  hash_calls = 0;
+//  for (const std::string& k : keys)
+//    m.put(k,0);
+//  ASSERT_EQ(keys.size(), hash_calls);
+//  m.reserve(8*test_size);
+//  m.shrink_to_fit();
+//  ASSERT_EQ(keys.size(), hash_calls);
+//
+//  //Hash codes are compared before keys: a hit compares one key, a miss (almost surely) none
+//  equals_calls = 0;
+//  for (const std::string& k : keys)
+//    ASSERT_TRUE(m.has_key(k));
+//  ASSERT_EQ(keys.size(), equals_calls);
+//  equals_calls = 0;
+//  for (const std::string& k : keys)
+//    ASSERT_FALSE(m.has_key(k + "x"));
+//  ASSERT_EQ(0u, equals_calls);
+//
+//  //Copies reuse the memoized codes too
+//  hash_calls = 0;
+//  ics::PolicyHashMap<std::string,int,CountingHash,CountingEquals> c(m);
+//  c.put("another",0);
+//  ASSERT_EQ(1u, hash_calls);
+//}
+//
+//
+//TEST_F(MapTest, slab_allocator) {
+//  typedef ics::HashMap<std::string,int,hash_string,ics::SlabNodeAllocator> SlabMapTypeStr;
+//  SlabMapTypeStr s;
+//  MapTypeStr     h;
+//
+//  //Recycled (erased) and bulk released (cleared) nodes are reused correctly
+//  for (int round=0; round<3; ++round) {
+//    for (int i=0; i<test_size; ++i) {
+//      s.put(std::to_string(i), i+round);
+//      h.put(std::to_string(i), i+round);
+//    }
+//    for (int i=0; i<test_size; i+=2)
+//      ASSERT_EQ(h.erase(std::to_string(i)), s.erase(std::to_string(i)));
+//    ASSERT_EQ(h.size(), s.size());
+//    for (auto kv : h)
+//      ASSERT_EQ(kv.second, s[kv.first]);
+//    if (round == 1) {
+//      s.clear();
+//      h.clear();
+//      ASSERT_TRUE(s.empty());
+//    }
+//  }
+//
+//  //Copies get their own slabs
+//  SlabMapTypeStr c(s);
+//  s.clear();
+//  ASSERT_EQ(h.size(), c.size());
+//  for (auto kv : h)
+//    ASSERT_EQ(kv.second, c[kv.first]);
+//
+//  //Filling and clearing: the slabs skip a heap allocation per node
+//  ics::Stopwatch by_heap, by_slab;
+//  MapTypeInt heap;
+//  ics::HashMap<int,int,hash_int,ics::SlabNodeAllocator> slab;
+//  by_heap.start();
+//  for (int round=0; round<5; ++round, heap.clear())
+//    for (int i=0; i<speed_size; ++i)
+//      heap.put(i,i);
+//  by_heap.stop();
+//  by_slab.start();
+//  for (int round=0; round<5; ++round, slab.clear())
+//    for (int i=0; i<speed_size; ++i)
+//      slab.put(i,i);
+//  by_slab.stop();
+//  std::cout << "  heap nodes " << by_heap.read() << "s, slab nodes " << by_slab.read() << "s" << std::endl;
+//}
+//
+//
+//TEST_F(MapTest, incremental_resize) {
+//  //While resizing, stats().bins counts the new and the old bins: not a power of 2
+//  auto resizing = [] (const MapTypeInt& m) {std::size_t b = m.stats().bins; return (b & (b-1)) != 0;};
+//  MapTypeInt m;
+//  m.set_incremental_resize(true,1);
+//  int n = 0;
+//  while (n < 1000 || !resizing(m))
+//    m.put(n,n), ++n;
+//
+//  //Lookups search both bin arrays and never move nodes: the resize is still in progress
+//  for (int i=0; i<n; ++i)
+//    ASSERT_EQ(i, m[i]);
+//  ASSERT_FALSE(m.has_key(n));
+//  ASSERT_TRUE(resizing(m));
+//
+//  //Iteration visits the old bins too, and lookups do not invalidate the Iterator
+//  std::set<int> seen;
+//  for (auto i = m.begin(); i != m.end(); ++i) {
+//    ASSERT_TRUE(m.has_key(i->first));
+//    ASSERT_TRUE(seen.insert(i->first).second);
+//  }
+//  ASSERT_EQ(n, (int)seen.size());
+//
+//  //Erases (which migrate some old bins) find keys wherever they are
+//  for (int i=0; i<n; i+=3)
+//    ASSERT_EQ(i, m.erase(i));
+//  for (int i=0; i<n; ++i)
+//    ASSERT_EQ(i%3 != 0, m.has_key(i));
+//
+//  //A put migrates bins, but only the insertion counts as a modification
+//  auto i = m.begin();
+//  m[1] = -1;
+//  ASSERT_TRUE(m.has_key(i->first));          //i is still valid
+//  m.put(n,n);
+//  ASSERT_THROW(++i,ics::ConcurrentModificationError);
+//
+//  //Iterator::erase across both arrays leaves exactly the kept keys
+//  for (auto j = m.begin(); j != m.end(); ++j)
+//    if (j->first%2 != 0)
+//      j.erase();
+//  for (int i=0; i<=n; ++i)
+//    ASSERT_EQ((i%3 != 0 && i%2 == 0) || (i == n && n%2 == 0), m.has_key(i));
+//
+//  //Finishing the resize keeps every entry
+//  int size = m.size();
+//  m.set_incremental_resize(false);
+//  ASSERT_FALSE(resizing(m));
+//  ASSERT_EQ(size, m.size());
+//  for (int i=0; i<=n; ++i)
+//    ASSERT_EQ((i%3 != 0 && i%2 == 0) || (i == n && n%2 == 0), m.has_key(i));
+//
+//  //The slowest put: incremental spreads each rehash over later puts
+//  for (int incremental=0; incremental<2; ++incremental) {
+//    MapTypeInt timed;
+//    timed.set_incremental_resize(incremental == 1);
+//    double slowest = 0.;
+//    ics::Stopwatch sw;
+//    for (int i=0; i<speed_size; ++i) {
+//      sw.reset(); sw.start();
+//      timed.put(i,i);
+//      sw.stop();
+//      slowest = std::max(slowest, sw.read());
+//    }
+//    std::cout << "  slowest put (" << (incremental ? "incremental" : "all at once") << "): " << slowest << "s" << std::endl;
+//  }
+//}
+//
+//
 //TEST_F(MapTest, iterator_exception_concurrent_modification_error) {
 //  MapTypeStr m;
 //  load(m,"fcijbdegah", new int[10]{6,3,9,10,2,4,5,7,1,8});
@@ -861,6 +1627,351 @@
 //      }
 //    }
 //  }
+//
+//  //Lookups go straight to their bin: the average cost per put/has_key at 10M keys
+//  //  should stay within a constant (cache-miss) factor of the cost at 100K keys
+//  double per_key[2];
+//  int    sizes  [2] = {100000, 10000000};
+//  for (int s=0; s<2; ++s) {
+//    MapTypeInt    sm;
+//    ics::Stopwatch sw;
+//    sw.start();
+//    for (int i=0; i<sizes[s]; ++i)
+//      sm.put(i,i);
+//    for (int i=0; i<sizes[s]; ++i)
+//      ASSERT_TRUE(sm.has_key(i));
+//    sw.stop();
+//    per_key[s] = sw.read()/sizes[s];
+//    std::cout << "  " << sizes[s] << " keys: " << per_key[s]*1e9 << " ns per put+has_key" << std::endl;
+//  }
+//  ASSERT_LT(per_key[1], 10*per_key[0]);
+//
+//  //Batched lookups prefetch ahead: on a table larger than the last-level cache they should
+//  //  be faster than the same lookups one at a time
+//  MapTypeInt bm;
+//  bm.set_hash_mixing(true);
+//  for (int i=0; i<sizes[1]; ++i)
+//    bm.put(i,i);
+//  std::vector<int> keys;
+//  for (int i=0; i<4000000; ++i)
+//    keys.push_back(ics::rand_range(0,2*sizes[1]));
+//  const int batch = 256;
+//  bool found[batch];
+//  int hits[2] = {0,0};
+//  double secs[2];
+//  for (int which=0; which<2; ++which) {
+//    ics::Stopwatch sw;
+//    sw.start();
+//    for (std::size_t i=0; i+batch<=keys.size(); i += batch)
+//      if (which == 0) {
+//        for (int j=0; j<batch; ++j)
+//          hits[0] += bm.has_key(keys[i+j]);
+//      } else {
+//        bm.contains_many(&keys[i], batch, found);
+//        for (int j=0; j<batch; ++j)
+//          hits[1] += found[j];
+//      }
+//    sw.stop();
+//    secs[which] = sw.read();
+//  }
+//  ASSERT_EQ(hits[0], hits[1]);
+//  std::cout << "  " << keys.size() << " lookups: has_key " << secs[0]/keys.size()*1e9 << " ns, contains_many "
+//            << secs[1]/keys.size()*1e9 << " ns per key" << std::endl;
+//}
+//
+//
+////FlatHashMap keeps the same entries as HashMap; its probes touch one tag group and (usually)
+////  one slot, so lookups should be faster than walking HashMap's node lists
+//TEST_F(MapTest, flat_hash_map) {
+//  typedef ics::FlatHashMap<int,int,hash_int> FlatMapTypeInt;
+//  std::vector<int> keys;
+//  for (int i=0; i<speed_size; ++i)
+//    keys.push_back(ics::rand_range(0,4*speed_size));
+//  FlatMapTypeInt fm;
+//  MapTypeInt     hm;
+//  for (int i=0; i<speed_size; ++i) {
+//    ASSERT_EQ(hm.has_key(keys[i]), fm.has_key(keys[i]));
+//    fm.put(keys[i],i);
+//    hm.put(keys[i],i);
+//  }
+//  for (int i=0; i<speed_size; i+=2)
+//    if (hm.has_key(keys[i])) {
+//      ASSERT_EQ(hm.erase(keys[i]), fm.erase(keys[i]));
+//    }
+//  ASSERT_EQ(hm.size(), fm.size());
+//  for (auto kv : hm)
+//    ASSERT_EQ(kv.second, fm[kv.first]);
+//  ASSERT_THROW(FlatMapTypeInt too_big(~(~std::size_t(0) >> 1) + 1), ics::IcsError);
+//  ASSERT_THROW(FlatMapTypeInt bad(fm, 0.0), ics::IcsError);
+//  ASSERT_THROW(FlatMapTypeInt full(1.0), ics::IcsError);     //No empty slot would be left to stop a probe
+//  FlatMapTypeInt copy(fm, 0.9375);
+//  ASSERT_EQ(fm.size(), copy.size());
+//
+//  double secs[2];
+//  int    hits[2] = {0,0};
+//  for (int which=0; which<2; ++which) {
+//    ics::Stopwatch sw;
+//    sw.start();
+//    for (int pass=0; pass<4; ++pass)
+//      for (int i=0; i<speed_size; ++i)
+//        hits[which] += which == 0 ? hm.has_key(keys[i]+pass) : fm.has_key(keys[i]+pass);
+//    sw.stop();
+//    secs[which] = sw.read();
+//  }
+//  ASSERT_EQ(hits[0], hits[1]);
+//  std::cout << "  " << 4*speed_size << " lookups: HashMap " << 4*speed_size/secs[0]/1e6 << " M/s, FlatHashMap "
+//            << 4*speed_size/secs[1]/1e6 << " M/s" << std::endl;
+//}
+//
+//
+////Counts the nodes a HashMap allocates (and their size), to measure its memory per bin
+//long long   counted_nodes      = 0;
+//std::size_t counted_node_bytes = 0;
+//template<class N> class CountingNodeAllocator : public ics::HeapNodeAllocator<N> {
+//public:
+//  template<class... Args>
+//  N*   create  (Args&&... args) {++counted_nodes; counted_node_bytes = sizeof(N); return ics::HeapNodeAllocator<N>::create(std::forward<Args>(args)...);}
+//  void destroy (N* n)           {--counted_nodes; ics::HeapNodeAllocator<N>::destroy(n);}
+//};
+//
+//TEST_F(MapTest, bins_constructor) {
+//  MapTypeInt by_int(1000), by_size(std::size_t(1000)), none(0);
+//  ASSERT_EQ(1024u, by_int.stats().bins);
+//  ASSERT_EQ(1024u, by_size.stats().bins);
+//  ASSERT_EQ(1u, none.stats().bins);
+//
+//  //Sizes with no power of 2 >= them are rejected, not rounded forever
+//  ASSERT_THROW(MapTypeInt too_many(~std::size_t(0)), ics::IcsError);
+//  ASSERT_THROW(by_int.reserve(~std::size_t(0)), ics::IcsError);
+//  by_int.put(1,1);
+//  ASSERT_EQ(1, by_int[1]);
+//}
+//
+//
+//TEST_F(MapTest, memory_per_bin) {
+//  typedef ics::HashMap<std::string,int,hash_string,CountingNodeAllocator> CountedMap;
+//  const int many_bins = 1 << 20;
+//  {
+//    CountedMap cm(many_bins);
+//    ASSERT_EQ(0, counted_nodes);        //Empty bins are nullptr: no per-bin node
+//    for (int i=0; i<test_size; ++i)
+//      cm.put(std::to_string(i),i);
+//    ASSERT_EQ((long long)cm.size(), counted_nodes);
+//    cm.clear();
+//    ASSERT_EQ(0, counted_nodes);
+//
+//    std::cout << "  " << many_bins << " empty bins: " << sizeof(void*) + 1.0/8 << " bytes per bin (list head + occupancy bit)"
+//              << " (was " << sizeof(void*) + counted_node_bytes << " + allocator overhead with a trailer node per bin)" << std::endl;
+//  }
+//  ASSERT_EQ(0, counted_nodes);
+//}
+//
+//
+////Maps of at most 8 entries use one inline bin (no heap bins); beyond that they are hashed,
+////  and (with a shrink threshold) erasing back down returns them to the inline bin
+//TEST_F(MapTest, small_maps) {
+//  MapTypeStr m;
+//  m.set_shrink_threshold(0.125);
+//  ASSERT_EQ(1u, m.stats().bins);
+//  ASSERT_EQ(0u, m.stats().bytes_allocated);
+//  for (int i=0; i<8; ++i)
+//    m.put(std::to_string(i),i);
+//  ASSERT_EQ(1u, m.stats().bins);
+//  for (int i=8; i<100; ++i)
+//    m.put(std::to_string(i),i);
+//  ASSERT_LT(1u, m.stats().bins);
+//  for (int i=0; i<100; ++i)
+//    ASSERT_EQ(i, m[std::to_string(i)]);
+//  for (int i=1; i<100; ++i)
+//    m.erase(std::to_string(i));
+//  ASSERT_EQ(1u, m.stats().bins);
+//  ASSERT_EQ(0, m["0"]);
+//
+//  MapTypeStr c(m);
+//  ASSERT_EQ(m, c);
+//  c = MapTypeStr({EntryType("a",1),EntryType("b",2),EntryType("c",3)});
+//  ASSERT_EQ(1u, c.stats().bins);
+//  ASSERT_EQ(2, c["b"]);
+//
+//  //Inline nodes, spilling to the heap beyond the allocator's slots
+//  typedef ics::HashMap<std::string,int,hash_string,ics::InlineNodeAllocator> MapTypeInline;
+//  MapTypeInline s;
+//  for (int i=0; i<20; ++i)
+//    s.put(std::to_string(i),i);
+//  MapTypeInline s2(s);
+//  ASSERT_EQ(s, s2);
+//  for (int i=0; i<20; i += 2)
+//    s.erase(std::to_string(i));
+//  for (int i=0; i<20; ++i)
+//    ASSERT_EQ(i%2 == 1, s.has_key(std::to_string(i)));
+//  ASSERT_EQ(20, s2.size());
+//
+//  //Building many small maps
+//  const int maps = 100000;
+//  ics::Stopwatch watch;
+//  for (int small_bins = 1; small_bins <= 16; small_bins *= 16) {
+//    watch.reset(); watch.start();
+//    long long total = 0;
+//    for (int n=0; n<maps; ++n) {
+//      MapTypeInt mi(small_bins);
+//      for (int i=0; i<4; ++i)
+//        mi.put(i,n);
+//      total += mi.size();
+//    }
+//    watch.stop();
+//    ASSERT_EQ(4LL*maps, total);
+//    std::cout << "  " << small_bins << " initial bins: " << watch.read()/maps*1e9 << " ns per 4-entry map built and destroyed" << std::endl;
+//  }
+//  watch.reset(); watch.start();
+//  for (int n=0; n<maps; ++n) {
+//    ics::HashMap<int,int,hash_int,ics::InlineNodeAllocator> mi;
+//    for (int i=0; i<4; ++i)
+//      mi.put(i,n);
+//  }
+//  watch.stop();
+//  std::cout << "  1 inline bin, inline nodes: " << watch.read()/maps*1e9 << " ns per 4-entry map built and destroyed" << std::endl;
+//}
+//
+//
+//TEST_F(MapTest, concurrent_hash_map) {
+//  ics::ConcurrentHashMap<int,int,hash_int> cm(8);
+//  ASSERT_EQ(8, cm.shards());
+//  ASSERT_THROW(cm.set_shrink_threshold(0.5),ics::IcsError);
+//  cm.set_shrink_threshold(0.25);
+//  for (int i=0; i<100000; ++i)
+//    cm.put(i,i);
+//  ASSERT_EQ(7, cm.compute(6,[](int& v){++v;}));
+//  ASSERT_THROW(cm.compute_if_present(-1,[](int& v){++v;}),ics::KeyError);
+//
+//  //Erasing almost everything shrinks the shards and keeps the rest
+//  for (int i=0; i<100000; ++i)
+//    if (i%100 != 0) {
+//      ASSERT_EQ(i == 6 ? 7 : i, cm.erase(i));
+//    }
+//  ASSERT_THROW(cm.erase(1),ics::KeyError);
+//  ASSERT_EQ(1000u, cm.size());
+//  int sum = 0, v;
+//  cm.for_each([&](const ics::ConcurrentHashMap<int,int,hash_int>::Entry& kv){sum += kv.first == kv.second;});
+//  ASSERT_EQ(1000, sum);
+//  ASSERT_TRUE(cm.get(99900,v));
+//  ASSERT_EQ(99900, v);
+//  ASSERT_FALSE(cm.has_key(99901));
+//  cm.clear();
+//  ASSERT_TRUE(cm.empty());
+//}
+//
+//
+////Mixed read/write throughput (90% get, 10% put on random keys) for a ConcurrentHashMap vs one
+////  HashMap behind a global mutex; on a machine with enough cores the sharded map should scale
+////  near-linearly with the number of threads, while the global mutex does not scale at all
+//TEST_F(MapTest, concurrent_scaling) {
+//  const int key_range = 1000000, ops_per_thread = 1000000;
+//  for (int threads = 1; threads <= 16; threads *= 2) {
+//    ics::ConcurrentHashMap<int,int,hash_int> cm(64);
+//    MapTypeInt gm;
+//    std::mutex gm_lock;
+//    double secs[2];
+//    for (int which = 0; which < 2; ++which) {
+//      ics::Stopwatch sw;
+//      sw.start();
+//      std::vector<std::thread> workers;
+//      for (int t = 0; t < threads; ++t)
+//        workers.emplace_back([&,t]{
+//          unsigned r = 12345 + t;
+//          int found;
+//          for (int i = 0; i < ops_per_thread; ++i) {
+//            r = r*1103515245 + 12345;
+//            int k = (r >> 8) % key_range;
+//            if (which == 0) {
+//              if (i%10 == 0) cm.put(k,i); else cm.get(k,found);
+//            } else {
+//              std::lock_guard<std::mutex> g(gm_lock);
+//              if (i%10 == 0) gm.put(k,i); else if (gm.has_key(k)) found = gm[k];
+//            }
+//          }
+//        });
+//      for (std::thread& w : workers)
+//        w.join();
+//      sw.stop();
+//      secs[which] = sw.read();
+//    }
+//    ASSERT_EQ(gm.size(), cm.size());   //Same keys were put into both (values may differ)
+//    std::cout << "  " << threads << " threads: sharded " << threads*ops_per_thread/secs[0]/1e6 << " Mops/s, global mutex "
+//              << threads*ops_per_thread/secs[1]/1e6 << " Mops/s" << std::endl;
+//  }
+//}
+//
+//
+////Readers must see every key exactly as last put (old or new value, never a torn or freed one)
+////  while a writer keeps replacing/erasing/growing; also reports lock-free vs sharded read speed
+//TEST_F(MapTest, read_mostly_concurrent) {
+//  const int key_range = 100000, reads_per_thread = 2000000, threads = 4;
+//  ics::ReadMostlyHashMap<int,int,hash_int> rm;
+//  ics::ConcurrentHashMap<int,int,hash_int> cm(64);
+//  for (int k = 0; k < key_range; ++k) {
+//    rm.put(k,k);
+//    cm.put(k,k);
+//  }
+//  double secs[2];
+//  for (int which = 0; which < 2; ++which) {
+//    std::atomic<bool> stop(false);
+//    std::thread writer([&]{
+//      for (int i = 0; !stop; i = (i+1)%key_range) {
+//        if (which == 0) {rm.put(i,-i); rm.erase(i); rm.put(i,i);} else {cm.put(i,-i); cm.erase(i); cm.put(i,i);}
+//        std::this_thread::yield();
+//      }
+//    });
+//    ics::Stopwatch sw;
+//    sw.start();
+//    std::vector<std::thread> readers;
+//    std::atomic<int> bad(0);
+//    for (int t = 0; t < threads; ++t)
+//      readers.emplace_back([&,t]{
+//        unsigned r = 12345 + t;
+//        int found;
+//        for (int i = 0; i < reads_per_thread; ++i) {
+//          r = r*1103515245 + 12345;
+//          int k = (r >> 8) % key_range;
+//          if ((which == 0 ? rm.get(k,found) : cm.get(k,found)) && found != k && found != -k)
+//            ++bad;
+//        }
+//      });
+//    for (std::thread& rd : readers)
+//      rd.join();
+//    sw.stop();
+//    stop = true;
+//    writer.join();
+//    secs[which] = sw.read();
+//    ASSERT_EQ(0, bad.load());
+//  }
+//  ASSERT_EQ((std::size_t)key_range, rm.size());
+//  std::cout << "  " << threads << " readers + 1 writer: lock-free " << threads*reads_per_thread/secs[0]/1e6
+//            << " Mreads/s, sharded " << threads*reads_per_thread/secs[1]/1e6 << " Mreads/s" << std::endl;
+//}
+//
+//
+////Sizes, counts and hashes are std::size_t: more than 2^31 entries must work. Needs ~80GB,
+////  so it runs only when asked for: --gtest_also_run_disabled_tests
+//std::size_t hash_ll (const long long& k) {std::hash<long long> ll_hash; return ll_hash(k);}
+//TEST_F(MapTest, DISABLED_beyond_int_range) {
+//  ics::HashMap<long long,char,hash_ll,ics::SlabNodeAllocator> bm;
+//  const long long n = (1LL << 31) + 1000;
+//  for (long long i=0; i<n; ++i)
+//    bm.put(i,(char)i);
+//  ASSERT_EQ((std::size_t)n, bm.size());
+//  for (long long i=0; i<n; i += 9973)
+//    ASSERT_EQ((char)i, bm[i]);
+//  ASSERT_TRUE(bm.has_key(n-1));
+//  ASSERT_FALSE(bm.has_key(n));
+//
+//  std::size_t iterated = 0;
+//  for (auto& kv : bm)
+//    iterated += kv.second == (char)kv.first;
+//  ASSERT_EQ((std::size_t)n, iterated);
+//
+//  for (long long i=0; i<1000; ++i)
+//    ASSERT_EQ((char)i, bm.erase(i));
+//  ASSERT_EQ((std::size_t)1 << 31, bm.size());
 //}
 //
 //
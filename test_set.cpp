@@ -7,9 +7,9 @@
 //#include "array_set.hpp"             // must leave in when testing other kinds of sets
 //#include "hash_set.hpp"
 //
-//int hash_string  (const std::string& s) {std::hash<std::string> str_hash; return str_hash(s);}
-//int hash_int     (const int& s)         {std::hash<int> str_hash; return str_hash(s);}
-//int hash_string2 (const std::string& s) {std::hash<std::string> str_hash; return 1+str_hash(s);}
+//std::size_t hash_string  (const std::string& s) {return ics::string_hash(s);}
+//std::size_t hash_int     (const int& s)         {std::hash<int> str_hash; return str_hash(s);}
+//std::size_t hash_string2 (const std::string& s) {return 1+ics::string_hash(s);}
 //
 //typedef ics::HashSet<std::string,hash_string> SetTypeStr;
 //typedef ics::HashSet<int,hash_int>            SetTypeInt;